@@ -0,0 +1,247 @@
+//========================================================//
+//  batch.c                                               //
+//  Source file for the batch mode                        //
+//                                                        //
+//  Each trace is one pool task that decodes it and then  //
+//  queues one simulation per predictor on its own deque; //
+//  idle workers steal those, so the whole matrix takes   //
+//  about as long as its slowest single simulation        //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "batch.h"
+#include "pool.h"
+#include "sweep.h"
+
+// Predictors of record.md, used when none are given
+static char *default_specs[] = { "gshare:13", "tournament:9:10:10", "custom" };
+
+typedef struct batch batch_t;
+
+typedef struct {
+  batch_t *batch;
+  const char *path;
+  char name[64];          // Column header: file name without extensions
+  off_t size;
+  trace_buf_t tb;
+  char err[128];          // Set when the trace fails to load
+  int remaining;          // Simulations still replaying 'tb'
+  int index;
+} batch_trace_t;
+
+typedef struct {
+  batch_trace_t *trace;
+  int config;
+} batch_job_t;
+
+struct batch {
+  pool_t *pool;
+  const predictor_config_t *configs;
+  int nconfigs;
+  batch_trace_t *traces;
+  int ntraces;
+  batch_job_t *jobs;      // ntraces x nconfigs
+  sweep_result_t *results;
+};
+
+static void
+simulate_task(void *arg)
+{
+  batch_job_t *job = arg;
+  batch_trace_t *t = job->trace;
+  batch_t *b = t->batch;
+
+  b->results[t->index * b->nconfigs + job->config] =
+      sweep_simulate(&b->configs[job->config], &t->tb);
+
+  // The last simulation of a trace releases it
+  if (__sync_sub_and_fetch(&t->remaining, 1) == 0) {
+    trace_buf_free(&t->tb);
+  }
+}
+
+static void
+load_task(void *arg)
+{
+  batch_trace_t *t = arg;
+  batch_t *b = t->batch;
+
+  if (!trace_load(t->path, &t->tb, t->err, sizeof(t->err))) {
+    return;
+  }
+  t->remaining = b->nconfigs;
+  for (int i = 0; i < b->nconfigs; i++) {
+    batch_job_t *job = &b->jobs[t->index * b->nconfigs + i];
+    job->trace = t;
+    job->config = i;
+    pool_submit(b->pool, simulate_task, job);
+  }
+}
+
+// Start the biggest traces first, their simulations take longest
+//
+static int
+by_size(const void *a, const void *b)
+{
+  const batch_trace_t *x = *(batch_trace_t *const *)a;
+  const batch_trace_t *y = *(batch_trace_t *const *)b;
+  return (y->size > x->size) - (y->size < x->size);
+}
+
+static void
+trace_name(const char *path, char *name, size_t len)
+{
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  size_t n = strcspn(base, ".");
+  if (n >= len) {
+    n = len - 1;
+  }
+  memcpy(name, base, n);
+  name[n] = '\0';
+}
+
+static float
+rate(const sweep_result_t *r)
+{
+  return 100*((float)r->mispredictions / (float)r->num_branches);
+}
+
+static void
+print_table(batch_t *b, const char *format)
+{
+  char name[64];
+  int md = !strcmp(format, "md");
+  const char *sep = md ? "|" : ",";
+
+  if (!strcmp(format, "json")) {
+    printf("{\n  \"traces\": [");
+    for (int t = 0; t < b->ntraces; t++) {
+      printf("%s\"%s\"", t ? ", " : "", b->traces[t].name);
+    }
+    printf("],\n  \"results\": [\n");
+    for (int c = 0; c < b->nconfigs; c++) {
+      float sum = 0;
+      predictor_format(&b->configs[c], name, sizeof(name));
+      printf("    { \"predictor\": \"%s\", \"traces\": [\n", name);
+      for (int t = 0; t < b->ntraces; t++) {
+        sweep_result_t *r = &b->results[t * b->nconfigs + c];
+        sum += rate(r);
+        printf("        { \"trace\": \"%s\", \"branches\": %llu, "
+               "\"incorrect\": %llu, \"rate\": %.3f }%s\n",
+               b->traces[t].name, (unsigned long long)r->num_branches,
+               (unsigned long long)r->mispredictions,
+               rate(r), t + 1 < b->ntraces ? "," : "");
+      }
+      printf("      ], \"average\": %.3f }%s\n", sum / b->ntraces,
+             c + 1 < b->nconfigs ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return;
+  }
+
+  // Markdown in the layout of record.md, or CSV
+  printf("%s", md ? "predictor\\trace" : "predictor");
+  for (int t = 0; t < b->ntraces; t++) {
+    printf("%s%s", sep, b->traces[t].name);
+  }
+  printf("%saverage\n", sep);
+  if (md) {
+    printf("---");
+    for (int t = 0; t <= b->ntraces; t++) {
+      printf("|---");
+    }
+    printf("\n");
+  }
+  for (int c = 0; c < b->nconfigs; c++) {
+    float sum = 0;
+    predictor_format(&b->configs[c], name, sizeof(name));
+    printf("%s", name);
+    for (int t = 0; t < b->ntraces; t++) {
+      float r = rate(&b->results[t * b->nconfigs + c]);
+      sum += r;
+      printf("%s%.3f", sep, r);
+    }
+    printf("%s%.3f\n", sep, sum / b->ntraces);
+  }
+}
+
+int
+batch_main(char **traces, int ntraces, char **specs, int nspecs,
+           int threads, const char *format)
+{
+  predictor_config_t *configs = NULL;
+  int n = 0;
+  int status = 0;
+
+  if (strcmp(format, "md") && strcmp(format, "csv") && strcmp(format, "json")) {
+    fprintf(stderr, "Unknown batch format %s\n", format);
+    return 1;
+  }
+  if (ntraces == 0) {
+    fprintf(stderr, "Batch mode needs at least one trace file\n");
+    return 1;
+  }
+  if (nspecs == 0) {
+    specs = default_specs;
+    nspecs = sizeof(default_specs) / sizeof(default_specs[0]);
+  }
+  for (int i = 0; i < nspecs; i++) {
+    if (!sweep_expand(specs[i], &configs, &n)) {
+      fprintf(stderr, "Invalid batch scheme --%s\n", specs[i]);
+      return 1;
+    }
+  }
+
+  batch_t b = { NULL, configs, n, NULL, ntraces, NULL, NULL };
+  b.traces = calloc(ntraces, sizeof(batch_trace_t));
+  b.jobs = calloc((size_t)ntraces * n, sizeof(batch_job_t));
+  b.results = calloc((size_t)ntraces * n, sizeof(sweep_result_t));
+  batch_trace_t **order = malloc(ntraces * sizeof(batch_trace_t *));
+
+  for (int t = 0; t < ntraces; t++) {
+    struct stat st;
+    batch_trace_t *bt = &b.traces[t];
+    bt->batch = &b;
+    bt->path = traces[t];
+    bt->index = t;
+    bt->size = stat(traces[t], &st) == 0 ? st.st_size : 0;
+    trace_name(traces[t], bt->name, sizeof(bt->name));
+    order[t] = bt;
+  }
+  qsort(order, ntraces, sizeof(batch_trace_t *), by_size);
+
+  // Each load task decompresses a .bz2 trace on threads of its own, so
+  // the cores are shared out between the traces the workers can be
+  // loading at once rather than given to every one of them
+  int workers = threads > 0 ? threads : sysconf(_SC_NPROCESSORS_ONLN);
+  int loading = ntraces < workers ? ntraces : workers;
+  traceThreads = loading > 0 && workers / loading > 1 ? workers / loading : 1;
+
+  b.pool = pool_create(threads);
+  for (int t = 0; t < ntraces; t++) {
+    pool_submit(b.pool, load_task, order[t]);
+  }
+  pool_destroy(b.pool);
+
+  for (int t = 0; t < ntraces; t++) {
+    if (b.traces[t].err[0] != '\0') {
+      fprintf(stderr, "%s: %s\n", b.traces[t].path, b.traces[t].err);
+      status = 1;
+    }
+  }
+  if (status == 0) {
+    print_table(&b, format);
+  }
+
+  free(order);
+  free(b.results);
+  free(b.jobs);
+  free(b.traces);
+  free(configs);
+  return status;
+}
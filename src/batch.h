@@ -0,0 +1,22 @@
+//========================================================//
+//  batch.h                                               //
+//  Header file for the batch mode                        //
+//                                                        //
+//  Simulates every (trace, predictor) pair on the work-  //
+//  stealing pool and prints the results matrix           //
+//========================================================//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+// Batch mode of the predictor: simulate every point of 'specs' (or
+// the gshare/tournament/custom set of record.md) over each of the
+// 'ntraces' traces and print one table in 'format' ("md", "csv" or
+// "json"), with the average misprediction rate of every predictor
+//
+// Returns the process exit status
+//
+int batch_main(char **traces, int ntraces, char **specs, int nspecs,
+               int threads, const char *format);
+
+#endif
@@ -0,0 +1,252 @@
+//========================================================//
+//  benchmark.c                                           //
+//  Measures the simulation throughput of the predictors  //
+//                                                        //
+//  Every trace is decoded once up front, so only the     //
+//  simulation is timed; each (predictor, trace) pair is  //
+//  run once to warm up and then timed over several       //
+//  trials, keeping the median                            //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "predictor.h"
+#include "sweep.h"
+#include "trace.h"
+
+// Predictors measured when none are given
+static char *default_specs[] = { "static", "gshare:10", "gshare:13",
+                                 "gshare:16", "tournament:9:10:10", "custom" };
+
+typedef struct {
+  char predictor[64];
+  char trace[64];
+  double rate;            // Median branches/sec
+  double baseline;        // Branches/sec of the baseline, 0 if absent
+} bench_result_t;
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: benchmark <options> <trace>...\n");
+  fprintf(stderr," Options:\n");
+  fprintf(stderr," --help              Print this message\n");
+  fprintf(stderr," --<type>            Predictor to measure, as for the predictor\n"
+                 "                     (default static, gshare:10/13/16,\n"
+                 "                     tournament:9:10:10 and custom)\n");
+  fprintf(stderr," --trials:<n>        Timed runs of each pair (default 5)\n");
+  fprintf(stderr," --save:<file>       Write the results as a JSON baseline\n");
+  fprintf(stderr," --baseline:<file>   Compare with a JSON baseline\n");
+  fprintf(stderr," --tolerance:<pct>   Slowdown flagged as a regression (default 10)\n");
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+by_value(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void
+trace_name(const char *path, char *name, size_t len)
+{
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  size_t n = strcspn(base, ".");
+  if (n >= len) {
+    n = len - 1;
+  }
+  memcpy(name, base, n);
+  name[n] = '\0';
+}
+
+// Fill in the baseline rate of every result from a file written by
+// --save
+//
+// Returns True if Successful
+//
+static int
+load_baseline(const char *path, bench_result_t *results, int n)
+{
+  char line[512];
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char predictor[64], trace[64];
+    double rate;
+    if (sscanf(line, " { \"predictor\": \"%63[^\"]\", \"trace\": \"%63[^\"]\", "
+               "\"branches_per_sec\": %lf", predictor, trace, &rate) != 3) {
+      continue;
+    }
+    for (int i = 0; i < n; i++) {
+      if (!strcmp(results[i].predictor, predictor) &&
+          !strcmp(results[i].trace, trace)) {
+        results[i].baseline = rate;
+      }
+    }
+  }
+  fclose(f);
+  return 1;
+}
+
+// Returns True if Successful
+//
+static int
+save_results(const char *path, const bench_result_t *results, int n, long rss)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    return 0;
+  }
+  fprintf(f, "{\n  \"peak_rss_kb\": %ld,\n  \"results\": [\n", rss);
+  for (int i = 0; i < n; i++) {
+    fprintf(f, "    { \"predictor\": \"%s\", \"trace\": \"%s\", "
+            "\"branches_per_sec\": %.0f }%s\n", results[i].predictor,
+            results[i].trace, results[i].rate, i + 1 < n ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  int ok = !ferror(f);
+  return (fclose(f) == 0) && ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char **specs = NULL;
+  int nspecs = 0;
+  char **traces = NULL;
+  int ntraces = 0;
+  int trials = 5;
+  double tolerance = 10;
+  char *save = NULL;
+  char *baseline = NULL;
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i],"--help")) {
+      usage();
+      exit(0);
+    } else if (!strncmp(argv[i],"--trials:",9)) {
+      trials = atoi(argv[i]+9);
+    } else if (!strncmp(argv[i],"--save:",7)) {
+      save = argv[i]+7;
+    } else if (!strncmp(argv[i],"--baseline:",11)) {
+      baseline = argv[i]+11;
+    } else if (!strncmp(argv[i],"--tolerance:",12)) {
+      tolerance = atof(argv[i]+12);
+    } else if (!strncmp(argv[i],"--",2)) {
+      specs = realloc(specs, (nspecs + 1) * sizeof(char *));
+      specs[nspecs++] = argv[i]+2;
+    } else {
+      traces = realloc(traces, (ntraces + 1) * sizeof(char *));
+      traces[ntraces++] = argv[i];
+    }
+  }
+  if (ntraces == 0 || trials < 1) {
+    usage();
+    exit(1);
+  }
+  if (nspecs == 0) {
+    specs = default_specs;
+    nspecs = sizeof(default_specs) / sizeof(default_specs[0]);
+  }
+
+  predictor_config_t *configs = malloc(nspecs * sizeof(predictor_config_t));
+  for (int c = 0; c < nspecs; c++) {
+    if (!predictor_parse(specs[c], &configs[c])) {
+      fprintf(stderr, "Invalid scheme --%s\n", specs[c]);
+      exit(1);
+    }
+  }
+
+  int n = nspecs * ntraces;
+  bench_result_t *results = calloc(n, sizeof(bench_result_t));
+  double *times = malloc(trials * sizeof(double));
+
+  for (int t = 0; t < ntraces; t++) {
+    // Decode the trace up front, only the simulation is timed
+    trace_buf_t tb;
+    char err[128];
+    if (!trace_load(traces[t], &tb, err, sizeof(err))) {
+      fprintf(stderr, "%s: %s\n", traces[t], err);
+      exit(1);
+    }
+
+    for (int c = 0; c < nspecs; c++) {
+      bench_result_t *r = &results[t * nspecs + c];
+      predictor_format(&configs[c], r->predictor, sizeof(r->predictor));
+      trace_name(traces[t], r->trace, sizeof(r->trace));
+
+      // One untimed run brings the trace and the code into the caches
+      sweep_simulate(&configs[c], &tb);
+      for (int i = 0; i < trials; i++) {
+        double start = now();
+        sweep_simulate(&configs[c], &tb);
+        times[i] = now() - start;
+      }
+      qsort(times, trials, sizeof(double), by_value);
+      r->rate = tb.n / times[trials / 2];
+    }
+    trace_buf_free(&tb);
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+
+  if (baseline != NULL && !load_baseline(baseline, results, n)) {
+    perror(baseline);
+    exit(1);
+  }
+
+  // Print the results, flagging every pair slower than the baseline
+  // by more than the tolerance
+  int regressions = 0;
+  printf("%-24s %-10s %16s %16s %8s\n", "Predictor", "Trace", "Branches/sec",
+         "Baseline", "Change");
+  for (int i = 0; i < n; i++) {
+    bench_result_t *r = &results[i];
+    printf("%-24s %-10s %16.0f", r->predictor, r->trace, r->rate);
+    if (r->baseline > 0) {
+      double change = 100 * (r->rate / r->baseline - 1);
+      int slow = change < -tolerance;
+      regressions += slow;
+      printf(" %16.0f %+7.1f%%%s\n", r->baseline, change,
+             slow ? "  REGRESSION" : "");
+    } else {
+      printf(" %16s %8s\n", "-", "-");
+    }
+  }
+  printf("Peak RSS:        %10ld KB\n", ru.ru_maxrss);
+  if (baseline != NULL) {
+    printf("Regressions:     %10d (beyond %.1f%%)\n", regressions, tolerance);
+  }
+
+  if (save != NULL && !save_results(save, results, n, ru.ru_maxrss)) {
+    perror(save);
+    exit(1);
+  }
+
+  free(times);
+  free(results);
+  free(configs);
+  return regressions ? 1 : 0;
+}
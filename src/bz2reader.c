@@ -0,0 +1,439 @@
+//========================================================//
+//  bz2reader.c                                           //
+//  Source file for the parallel bzip2 decompressor       //
+//                                                        //
+//  bzip2 blocks are independent: each one is located by  //
+//  its 48-bit magic, wrapped in a one-block stream and   //
+//  decompressed with libbz2 on a worker thread           //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <bzlib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "bz2reader.h"
+
+#define BLOCK_MAGIC  0x314159265359ULL  // Start of a compressed block
+#define EOS_MAGIC    0x177245385090ULL  // End of a bzip2 stream
+#define MAGIC_BITS   48
+#define MAX_EXTEND   8                  // Retries past a false block magic
+
+// A decompressed block waiting in the queue
+typedef struct {
+  int ready;
+  int ok;
+  uint64_t start, end;  // Compressed bit range that was decoded
+  char *data;
+  size_t len;
+} slot_t;
+
+struct bz2_reader {
+  const uint8_t *data;
+  size_t len;
+  uint64_t nbits;
+
+  pthread_mutex_t lock;
+  pthread_cond_t space;   // Signalled when the consumer frees a slot
+  pthread_cond_t filled;  // Signalled when a worker fills a slot
+  pthread_t *workers;
+  int nworkers;
+  int stop;
+
+  // Block scanner, shared by the workers under 'lock'
+  uint64_t cur;           // Bit offset of the next magic
+  int level;              // Block size level of the current stream
+  int scan_done;
+
+  // Reorder queue
+  slot_t *slots;
+  uint32_t nslots;
+  uint64_t next_seq;      // Sequence number of the next block handed out
+  uint64_t consumed;      // Sequence number of the next block to return
+  uint64_t covered;       // Compressed bits returned so far
+  char *current;          // Chunk returned by the last bz2_reader_next
+  char error[128];
+};
+
+// Candidate values of the byte after the one a magic starts in, for
+// all 8 bit alignments of both magics
+static uint8_t magic_byte[256];
+static pthread_once_t magic_once = PTHREAD_ONCE_INIT;
+
+static void
+init_magic_byte(void)
+{
+  for (int s = 0; s < 8; s++) {
+    magic_byte[(uint8_t)(BLOCK_MAGIC >> (32 + s))] = 1;
+    magic_byte[(uint8_t)(EOS_MAGIC >> (32 + s))] = 1;
+  }
+}
+
+//------------------------------------//
+//           Bit Helpers              //
+//------------------------------------//
+
+// Load the 8 bytes at 'byte' as a big-endian word, zero padded past
+// the end of the data
+//
+static inline uint64_t
+peek64(const uint8_t *data, size_t len, size_t byte)
+{
+  uint64_t w = 0;
+  if (byte + 8 <= len) {
+    memcpy(&w, data + byte, 8);
+    return __builtin_bswap64(w);
+  }
+  for (int i = 0; i < 8; i++) {
+    w = (w << 8) | ((byte + i < len) ? data[byte + i] : 0);
+  }
+  return w;
+}
+
+// Read 'n' (<= 32) bits starting at bit offset 'pos'
+//
+static inline uint32_t
+get_bits(const bz2_reader_t *r, uint64_t pos, int n)
+{
+  uint64_t w = peek64(r->data, r->len, pos >> 3);
+  return (uint32_t)((w << (pos & 7)) >> (64 - n));
+}
+
+static inline uint64_t
+get_magic(const bz2_reader_t *r, uint64_t pos)
+{
+  return ((uint64_t)get_bits(r, pos, 24) << 24) | get_bits(r, pos + 24, 24);
+}
+
+// Find the first block or end-of-stream magic at or after bit 'from'
+//
+// Returns its bit offset, or nbits if there is none
+//
+static uint64_t
+find_magic(const bz2_reader_t *r, uint64_t from)
+{
+  for (size_t k = from >> 3; (uint64_t)k * 8 + MAGIC_BITS <= r->nbits; k++) {
+    if (k + 1 < r->len && !magic_byte[r->data[k + 1]]) {
+      continue;
+    }
+    uint64_t w = peek64(r->data, r->len, k);
+    for (int s = 0; s < 8; s++) {
+      uint64_t pos = (uint64_t)k * 8 + s;
+      if (pos < from) {
+        continue;
+      }
+      if (pos + MAGIC_BITS > r->nbits) {
+        return r->nbits;
+      }
+      uint64_t v = (w >> (16 - s)) & 0xFFFFFFFFFFFFULL;
+      if (v == BLOCK_MAGIC || v == EOS_MAGIC) {
+        return pos;
+      }
+    }
+  }
+  return r->nbits;
+}
+
+typedef struct {
+  uint8_t *p;
+  uint64_t acc;
+  int n;
+} bitwriter_t;
+
+static inline void
+put_bits(bitwriter_t *w, uint32_t v, int n)
+{
+  w->acc = (w->acc << n) | v;
+  w->n += n;
+  while (w->n >= 8) {
+    w->n -= 8;
+    *w->p++ = (uint8_t)(w->acc >> w->n);
+  }
+}
+
+//------------------------------------//
+//        Block Decompression         //
+//------------------------------------//
+
+int
+bz2_detect(const uint8_t *data, size_t len)
+{
+  return len >= 4 && data[0] == 'B' && data[1] == 'Z' && data[2] == 'h' &&
+         data[3] >= '1' && data[3] <= '9';
+}
+
+// Decompress the compressed bits [start, end) of a single block by
+// wrapping them in a stream header and trailer.  The combined CRC of
+// a one-block stream is the CRC of that block.
+//
+// Returns True if Successful
+//
+static int
+decode_range(const bz2_reader_t *r, uint64_t start, uint64_t end, int level,
+             char **out, size_t *out_len)
+{
+  uint64_t nbits = end - start;
+  size_t in_len = 4 + (nbits + MAGIC_BITS + 32 + 7) / 8;
+  uint8_t *in = malloc(in_len);
+  bitwriter_t w = { in + 4, 0, 0 };
+
+  memcpy(in, "BZh", 3);
+  in[3] = '0' + level;
+  for (uint64_t pos = start; pos < end; pos += 32) {
+    int n = (end - pos < 32) ? (int)(end - pos) : 32;
+    put_bits(&w, get_bits(r, pos, n), n);
+  }
+  put_bits(&w, (uint32_t)(EOS_MAGIC >> 24), 24);
+  put_bits(&w, (uint32_t)(EOS_MAGIC & 0xFFFFFF), 24);
+  put_bits(&w, get_bits(r, start + MAGIC_BITS, 32), 32);
+  if (w.n > 0) {
+    put_bits(&w, 0, 8 - w.n);
+  }
+
+  bz_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) {
+    free(in);
+    return 0;
+  }
+
+  size_t cap = 1 << 20, len = 0;
+  char *buf = malloc(cap);
+  int ret;
+  strm.next_in = (char *)in;
+  strm.avail_in = w.p - in;
+  do {
+    if (len == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+    strm.next_out = buf + len;
+    strm.avail_out = cap - len;
+    ret = BZ2_bzDecompress(&strm);
+    len = cap - strm.avail_out;
+  } while (ret == BZ_OK && (strm.avail_in > 0 || strm.avail_out == 0));
+  BZ2_bzDecompressEnd(&strm);
+  free(in);
+
+  if (ret != BZ_STREAM_END) {
+    free(buf);
+    return 0;
+  }
+  *out = buf;
+  *out_len = len;
+  return 1;
+}
+
+// Hand out the bit range of the next block, moving across stream
+// boundaries.  Must be called with 'lock' held.
+//
+// Returns True if a block was found
+//
+static int
+scan_next(bz2_reader_t *r, uint64_t *start, uint64_t *end, int *level)
+{
+  while (!r->scan_done) {
+    if (r->cur + MAGIC_BITS > r->nbits) {
+      snprintf(r->error, sizeof(r->error), "truncated bzip2 stream");
+      r->scan_done = 1;
+      break;
+    }
+
+    uint64_t magic = get_magic(r, r->cur);
+    if (magic != BLOCK_MAGIC && magic != EOS_MAGIC) {
+      snprintf(r->error, sizeof(r->error), "bad bzip2 block header");
+      r->scan_done = 1;
+      break;
+    }
+    if (magic == BLOCK_MAGIC) {
+      *start = r->cur;
+      *end = find_magic(r, r->cur + MAGIC_BITS);
+      *level = r->level;
+      r->cur = *end;
+      return 1;
+    }
+
+    // End of stream: skip the stream CRC and padding, then continue
+    // with the next concatenated stream if there is one
+    size_t byte = (r->cur + MAGIC_BITS + 32 + 7) / 8;
+    if (byte >= r->len) {
+      r->scan_done = 1;
+    } else if (bz2_detect(r->data + byte, r->len - byte)) {
+      r->level = r->data[byte + 3] - '0';
+      r->cur = (uint64_t)(byte + 4) * 8;
+    } else {
+      // Data follows that is not a stream: the magic was a false match
+      // inside a block, whose worker will extend past it
+      r->cur = find_magic(r, r->cur + MAGIC_BITS);
+    }
+  }
+  return 0;
+}
+
+static void *
+worker_main(void *arg)
+{
+  bz2_reader_t *r = arg;
+
+  pthread_mutex_lock(&r->lock);
+  for (;;) {
+    while (!r->stop && r->next_seq - r->consumed >= r->nslots) {
+      pthread_cond_wait(&r->space, &r->lock);
+    }
+    uint64_t start, end;
+    int level;
+    if (r->stop || !scan_next(r, &start, &end, &level)) {
+      break;
+    }
+    uint64_t seq = r->next_seq++;
+    pthread_mutex_unlock(&r->lock);
+
+    // A false magic inside a block splits it in two; both halves then
+    // fail, so grow the range to the next magic and try again
+    char *data = NULL;
+    size_t len = 0;
+    int ok = 0;
+    for (int tries = 0; !ok && tries <= MAX_EXTEND; tries++) {
+      ok = decode_range(r, start, end, level, &data, &len);
+      if (!ok) {
+        if (end >= r->nbits) {
+          break;
+        }
+        end = find_magic(r, end + MAGIC_BITS);
+      }
+    }
+
+    pthread_mutex_lock(&r->lock);
+    slot_t *s = &r->slots[seq % r->nslots];
+    s->ok = ok;
+    s->start = start;
+    s->end = end;
+    s->data = data;
+    s->len = len;
+    s->ready = 1;
+    pthread_cond_broadcast(&r->filled);
+  }
+  pthread_cond_broadcast(&r->filled);
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+//------------------------------------//
+//          Reader Functions          //
+//------------------------------------//
+
+bz2_reader_t *
+bz2_reader_open(const uint8_t *data, size_t len, int threads)
+{
+  bz2_reader_t *r = calloc(1, sizeof(bz2_reader_t));
+
+  pthread_once(&magic_once, init_magic_byte);
+  r->data = data;
+  r->len = len;
+  r->nbits = (uint64_t)len * 8;
+  if (bz2_detect(data, len)) {
+    r->level = data[3] - '0';
+    r->cur = 32;
+  } else {
+    snprintf(r->error, sizeof(r->error), "not a bzip2 stream");
+    r->scan_done = 1;
+  }
+
+  if (threads < 1) {
+    threads = 1;
+  }
+  r->nworkers = threads;
+  r->nslots = 2 * threads;
+  r->slots = calloc(r->nslots, sizeof(slot_t));
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->space, NULL);
+  pthread_cond_init(&r->filled, NULL);
+  r->workers = malloc(threads * sizeof(pthread_t));
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&r->workers[i], NULL, worker_main, r);
+  }
+
+  return r;
+}
+
+const char *
+bz2_reader_next(bz2_reader_t *r, size_t *len)
+{
+  pthread_mutex_lock(&r->lock);
+  free(r->current);
+  r->current = NULL;
+
+  for (;;) {
+    slot_t *s = &r->slots[r->consumed % r->nslots];
+    if (s->ready) {
+      s->ready = 0;
+      r->consumed++;
+      pthread_cond_broadcast(&r->space);
+
+      if (s->start < r->covered) {
+        // Second half of a block split by a false magic, already
+        // decoded as part of the previous range
+        free(s->data);
+        continue;
+      }
+      if (!s->ok) {
+        snprintf(r->error, sizeof(r->error),
+                 "bzip2 data error in block at bit %llu",
+                 (unsigned long long)s->start);
+        break;
+      }
+      r->covered = s->end;
+      r->current = s->data;
+      *len = s->len;
+      pthread_mutex_unlock(&r->lock);
+      return r->current;
+    }
+    if (r->consumed == r->next_seq && r->scan_done) {
+      break;
+    }
+    pthread_cond_wait(&r->filled, &r->lock);
+  }
+
+  r->stop = 1;
+  pthread_cond_broadcast(&r->space);
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+uint64_t
+bz2_reader_position(bz2_reader_t *r)
+{
+  // Only bz2_reader_next moves 'covered', on this same thread
+  return r->covered / 8;
+}
+
+const char *
+bz2_reader_error(bz2_reader_t *r)
+{
+  return (r->error[0] != '\0') ? r->error : NULL;
+}
+
+void
+bz2_reader_close(bz2_reader_t *r)
+{
+  pthread_mutex_lock(&r->lock);
+  r->stop = 1;
+  pthread_cond_broadcast(&r->space);
+  pthread_mutex_unlock(&r->lock);
+  for (int i = 0; i < r->nworkers; i++) {
+    pthread_join(r->workers[i], NULL);
+  }
+
+  for (uint32_t i = 0; i < r->nslots; i++) {
+    if (r->slots[i].ready) {
+      free(r->slots[i].data);
+    }
+  }
+  free(r->current);
+  free(r->slots);
+  free(r->workers);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->space);
+  pthread_cond_destroy(&r->filled);
+  free(r);
+}
@@ -0,0 +1,47 @@
+//========================================================//
+//  bz2reader.h                                           //
+//  Header file for the parallel bzip2 decompressor       //
+//                                                        //
+//  Blocks of a bzip2 image are decompressed on a pool of //
+//  threads and handed back in order through a bounded    //
+//  queue                                                 //
+//========================================================//
+
+#ifndef BZ2READER_H
+#define BZ2READER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct bz2_reader bz2_reader_t;
+
+// Returns True if 'data' starts with a bzip2 stream header
+//
+int bz2_detect(const uint8_t *data, size_t len);
+
+// Start decompressing the bzip2 image 'data' (which must stay valid
+// until bz2_reader_close) on 'threads' worker threads
+//
+bz2_reader_t *bz2_reader_open(const uint8_t *data, size_t len, int threads);
+
+// Fetch the next chunk of decompressed bytes, in stream order.  The
+// chunk stays valid until the next call.
+//
+// Returns NULL at the end of the data or on error (see bz2_reader_error)
+//
+const char *bz2_reader_next(bz2_reader_t *r, size_t *len);
+
+// Returns a description of the decompression error, or NULL
+//
+const char *bz2_reader_error(bz2_reader_t *r);
+
+// Returns the bytes of the compressed image behind the chunks fetched
+// so far; called from the thread fetching them
+//
+uint64_t bz2_reader_position(bz2_reader_t *r);
+
+// Stop the workers and release all buffers
+//
+void bz2_reader_close(bz2_reader_t *r);
+
+#endif
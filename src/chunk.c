@@ -0,0 +1,116 @@
+//========================================================//
+//  chunk.c                                               //
+//  Source file for the chunked parallel simulation mode  //
+//                                                        //
+//  Only the first chunk starts from the state a serial   //
+//  run would have; the others rebuild it approximately   //
+//  from their warm-up, so the error shrinks as it grows  //
+//========================================================//
+
+#include <stdio.h>
+#include "chunk.h"
+#include "pool.h"
+#include "sweep.h"
+
+typedef struct {
+  const trace_buf_t *tb;
+  const predictor_config_t *config;
+  size_t warm;            // First branch of the warm-up
+  size_t start;           // First and last + 1 branch counted
+  size_t end;
+  uint64_t mispredictions;
+} chunk_job_t;
+
+static void
+chunk_task(void *arg)
+{
+  chunk_job_t *job = arg;
+  const trace_buf_t *tb = job->tb;
+  predictor_t *p = predictor_create(job->config);
+
+  sweep_replay(p, tb, job->warm, job->start);
+  job->mispredictions = sweep_replay(p, tb, job->start, job->end);
+  predictor_destroy(p);
+}
+
+static void
+serial_task(void *arg)
+{
+  chunk_job_t *job = arg;
+  job->mispredictions = sweep_simulate(job->config, job->tb).mispredictions;
+}
+
+int
+chunk_main(const char *path, const predictor_config_t *config,
+           int chunks, uint32_t warmup, int threads, int check)
+{
+  trace_buf_t tb;
+  char err[128];
+
+  if (chunks < 1) {
+    fprintf(stderr, "Chunked mode needs at least one chunk\n");
+    return 1;
+  }
+  if (!trace_load(path, &tb, err, sizeof(err))) {
+    fprintf(stderr, "%s: %s\n", path ? path : "stdin", err);
+    return 1;
+  }
+
+  // An empty trace is a single empty chunk.  Chunks shorter than their
+  // warm-up would spend most of the run re-training, so there are never
+  // more than the trace can hold
+  if (tb.n == 0) {
+    chunks = 1;
+  } else if (warmup > 0 && tb.n / chunks < warmup) {
+    int fit = tb.n / warmup > 0 ? (int)(tb.n / warmup) : 1;
+    fprintf(stderr, "Using %d chunks of at least the %u warm-up branches "
+            "instead of %d\n", fit, warmup, chunks);
+    chunks = fit;
+  }
+
+  // The serial reference is one more job, the longest, so it goes first
+  chunk_job_t *jobs = calloc(chunks + 1, sizeof(chunk_job_t));
+  chunk_job_t *serial = &jobs[chunks];
+  pool_t *pool = pool_create(threads);
+  if (check) {
+    serial->tb = &tb;
+    serial->config = config;
+    pool_submit(pool, serial_task, serial);
+  }
+  for (int i = 0; i < chunks; i++) {
+    chunk_job_t *job = &jobs[i];
+    job->tb = &tb;
+    job->config = config;
+    job->start = tb.n * i / chunks;
+    job->end = tb.n * (i + 1) / chunks;
+    job->warm = job->start > warmup ? job->start - warmup : 0;
+    pool_submit(pool, chunk_task, job);
+  }
+  pool_destroy(pool);
+
+  uint64_t num_branches = tb.n;
+  uint64_t mispredictions = 0;
+  for (int i = 0; i < chunks; i++) {
+    mispredictions += jobs[i].mispredictions;
+  }
+
+  // Print out the mispredict statistics
+  printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+  printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions);
+  float mispredict_rate = num_branches ?
+                          100*((float)mispredictions / (float)num_branches) : 0;
+  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  if (check) {
+    float serial_rate = num_branches ?
+                        100*((float)serial->mispredictions / (float)num_branches) : 0;
+    printf("Serial Incorrect:%10llu\n",
+           (unsigned long long)serial->mispredictions);
+    printf("Deviation:       %+10lld (%+.3f points)\n",
+           (long long)(mispredictions - serial->mispredictions),
+           mispredict_rate - serial_rate);
+  }
+
+  free(jobs);
+  trace_buf_free(&tb);
+  return 0;
+}
@@ -0,0 +1,28 @@
+//========================================================//
+//  chunk.h                                               //
+//  Header file for the chunked parallel simulation mode  //
+//                                                        //
+//  A single trace is split into chunks simulated by      //
+//  separate predictors, each warmed on the branches      //
+//  preceding its chunk                                   //
+//========================================================//
+
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stdint.h>
+#include "predictor.h"
+
+// Chunked mode of the predictor: split the trace at 'path' into
+// 'chunks' parts simulated in parallel on 'threads' pool threads (0
+// uses one per core), each by a fresh predictor built from 'config'
+// and trained first on the 'warmup' branches before its part.  The
+// merged counts approximate a serial run; with 'check' the serial run
+// is simulated too and the deviation from it is printed.
+//
+// Returns the process exit status
+//
+int chunk_main(const char *path, const predictor_config_t *config,
+               int chunks, uint32_t warmup, int threads, int check);
+
+#endif
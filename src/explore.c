@@ -0,0 +1,205 @@
+//========================================================//
+//  explore.c                                             //
+//  Source file for the storage budget explorer           //
+//                                                        //
+//  Points are pool tasks started from the fewest bits    //
+//  up, so the cheap points that prune the expensive ones //
+//  tend to finish first                                  //
+//========================================================//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "explore.h"
+#include "pool.h"
+#include "sweep.h"
+
+// Relative margin by which a point must trail a point of no more bits,
+// over the same traces (at least half of them), to be abandoned
+#define EXPLORE_MARGIN 0.10
+
+// Grid explored when no predictor options are given
+static char *default_specs[] = { "gshare:1-20", "tournament:6-13:6-13:6-13" };
+
+typedef struct explore explore_t;
+
+typedef struct {
+  explore_t *explore;
+  predictor_config_t config;
+  uint64_t bits;
+  double *rates;          // Misprediction rate on each finished trace
+  int done;               // Traces finished
+  int pruned;
+  double average;         // Average rate, once every trace is finished
+} explore_point_t;
+
+struct explore {
+  trace_buf_t *traces;
+  int ntraces;
+  explore_point_t *points;
+  int npoints;
+  pthread_mutex_t lock;   // Guards 'done' and 'rates' of every point
+};
+
+// Returns True if another point with no more bits beats 'p' by the
+// margin over the first 'k' traces
+//
+static int
+explore_losing(explore_t *e, const explore_point_t *p, int k)
+{
+  double sum = 0;
+  for (int t = 0; t < k; t++) {
+    sum += p->rates[t];
+  }
+  for (int i = 0; i < e->npoints; i++) {
+    const explore_point_t *q = &e->points[i];
+    if (q == p || q->bits > p->bits || q->done < k) {
+      continue;
+    }
+    double other = 0;
+    for (int t = 0; t < k; t++) {
+      other += q->rates[t];
+    }
+    if (other * (1 + EXPLORE_MARGIN) < sum) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+explore_task(void *arg)
+{
+  explore_point_t *p = arg;
+  explore_t *e = p->explore;
+
+  for (int t = 0; t < e->ntraces; t++) {
+    sweep_result_t r = sweep_simulate(&p->config, &e->traces[t]);
+
+    pthread_mutex_lock(&e->lock);
+    p->rates[t] = 100 * (double)r.mispredictions / r.num_branches;
+    p->done = t + 1;
+    // A single trace can favour small tables by more than the margin,
+    // so judge only once half of the traces are in
+    if (p->done < e->ntraces && 2 * p->done >= e->ntraces &&
+        explore_losing(e, p, p->done)) {
+      p->pruned = 1;
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    if (p->pruned) {
+      return;
+    }
+  }
+}
+
+// Fewest bits first, then lowest average rate
+//
+static int
+by_bits(const void *a, const void *b)
+{
+  const explore_point_t *x = a;
+  const explore_point_t *y = b;
+  if (x->bits != y->bits) {
+    return (x->bits > y->bits) - (x->bits < y->bits);
+  }
+  return (x->average > y->average) - (x->average < y->average);
+}
+
+int
+explore_main(char **traces, int ntraces, char **specs, int nspecs,
+             int threads, uint64_t budget)
+{
+  predictor_config_t *configs = NULL;
+  int n = 0;
+
+  if (ntraces == 0) {
+    fprintf(stderr, "Explore mode needs at least one trace file\n");
+    return 1;
+  }
+  if (nspecs == 0) {
+    specs = default_specs;
+    nspecs = sizeof(default_specs) / sizeof(default_specs[0]);
+  }
+  for (int i = 0; i < nspecs; i++) {
+    if (!sweep_expand(specs[i], &configs, &n)) {
+      fprintf(stderr, "Invalid explore scheme --%s\n", specs[i]);
+      return 1;
+    }
+  }
+
+  // Cost every point from its geometry; those over budget are never
+  // simulated
+  explore_t e = { .ntraces = ntraces };
+  e.points = calloc(n, sizeof(explore_point_t));
+  for (int i = 0; i < n; i++) {
+    uint64_t bits = predictor_bits(&configs[i]);
+    if (bits <= budget) {
+      explore_point_t *p = &e.points[e.npoints++];
+      p->explore = &e;
+      p->config = configs[i];
+      p->bits = bits;
+      p->rates = calloc(ntraces, sizeof(double));
+    }
+  }
+  qsort(e.points, e.npoints, sizeof(explore_point_t), by_bits);
+
+  e.traces = calloc(ntraces, sizeof(trace_buf_t));
+  for (int t = 0; t < ntraces; t++) {
+    char err[128];
+    if (!trace_load(traces[t], &e.traces[t], err, sizeof(err))) {
+      fprintf(stderr, "%s: %s\n", traces[t], err);
+      return 1;
+    }
+  }
+
+  pthread_mutex_init(&e.lock, NULL);
+  // Workers take their newest task first, so the most bits go in first
+  pool_t *pool = pool_create(threads);
+  for (int i = e.npoints - 1; i >= 0; i--) {
+    pool_submit(pool, explore_task, &e.points[i]);
+  }
+  pool_destroy(pool);
+  pthread_mutex_destroy(&e.lock);
+
+  int pruned = 0;
+  for (int i = 0; i < e.npoints; i++) {
+    explore_point_t *p = &e.points[i];
+    pruned += p->pruned;
+    for (int t = 0; t < ntraces; t++) {
+      p->average += p->rates[t] / ntraces;
+    }
+  }
+  printf("Budget:          %10llu bits\n", (unsigned long long)budget);
+  printf("Candidates:      %10d\n", n);
+  printf("Over Budget:     %10d\n", n - e.npoints);
+  printf("Abandoned:       %10d\n", pruned);
+  printf("Simulated:       %10d\n", e.npoints - pruned);
+
+  // Walking up in bits, a finished point is on the front when it beats
+  // every point before it
+  qsort(e.points, e.npoints, sizeof(explore_point_t), by_bits);
+  double best = 101;
+  printf("\n%-24s %12s %18s\n", "Predictor", "Bits", "Misprediction Rate");
+  for (int i = 0; i < e.npoints; i++) {
+    explore_point_t *p = &e.points[i];
+    if (!p->pruned && p->average < best) {
+      char name[64];
+      predictor_format(&p->config, name, sizeof(name));
+      printf("%-24s %12llu %18.3f\n", name, (unsigned long long)p->bits,
+             p->average);
+      best = p->average;
+    }
+  }
+
+  for (int t = 0; t < ntraces; t++) {
+    trace_buf_free(&e.traces[t]);
+  }
+  for (int i = 0; i < e.npoints; i++) {
+    free(e.points[i].rates);
+  }
+  free(e.traces);
+  free(e.points);
+  free(configs);
+  return 0;
+}
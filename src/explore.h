@@ -0,0 +1,30 @@
+//========================================================//
+//  explore.h                                             //
+//  Header file for the storage budget explorer           //
+//                                                        //
+//  Searches predictor configurations within a storage    //
+//  budget for the best bits/misprediction trade-offs     //
+//========================================================//
+
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+#include <stdint.h>
+
+// The custom predictor budget: 64K + 256 bits
+#define EXPLORE_BUDGET ((64 << 10) + 256)
+
+// Explore mode of the predictor: expand 'specs' (or a default
+// gshare/tournament grid) and drop every point storing more than
+// 'budget' bits.  Simulate the rest over the traces in order, on
+// 'threads' pool threads (0 uses one per core), abandoning a point
+// once it trails a point of no more bits by a clear margin over the
+// first half or more of the traces.  Print the Pareto front of bits against
+// the average misprediction rate.
+//
+// Returns the process exit status
+//
+int explore_main(char **traces, int ntraces, char **specs, int nspecs,
+                 int threads, uint64_t budget);
+
+#endif
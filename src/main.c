@@ -5,30 +5,146 @@
 //========================================================//
 
 #define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "batch.h"
+#include "chunk.h"
+#include "explore.h"
 #include "predictor.h"
+#include "predstream.h"
+#include "profile.h"
+#include "sweep.h"
+#include "timing.h"
+#include "trace.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+#define BLOCK_SIZE 4096  // Branches decoded per trace_read() call
+
+trace_t *trace;
+uint32_t pc_store[BLOCK_SIZE];
+uint8_t outcome_store[BLOCK_SIZE];
+uint32_t *pc_block = pc_store;  // Current block: decoded into the stores,
+uint8_t *outcome_block = outcome_store;  // or in place in 'dense'
+uint32_t *id_block;                      // Dense IDs of the block
+uint8_t prediction_block[BLOCK_SIZE];
+char text_block[2 * BLOCK_SIZE];  // --verbose lines of a block
+
+int threads;       // Worker threads (0 uses one per core)
+int sweep;         // Simulate every scheme given instead of the last one
+int batch;         // Simulate every scheme over every trace given
+char *format;      // Table format of the batch mode
+int explore;       // Search the schemes given within a storage budget
+uint64_t budget = EXPLORE_BUDGET;  // Bits allowed in the explore mode
+char **specs;      // Schemes given on the command line, without "--"
+int nspecs;
+char **traces;     // Trace files given on the command line
+int ntraces;
+int trace_next;    // Next of 'traces' for the main loop to read
+char *trace_path;  // Trace being read, NULL for stdin
+int bits;          // Print the storage of the scheme
+int chunks;        // Split the trace into this many parallel parts
+uint32_t warmup = 100000;  // Branches each part trains on before it
+int check;         // Also simulate serially and print the deviation
+int profile;       // Profile every static branch
+int profileTop = 20;   // Worst branches printed
+char *profileCsv;  // File receiving the whole profile
+int timingJson;    // Report the stage timers as JSON
+int densePcs;      // Decode the whole trace and number its branches first
+trace_buf_t dense; // The decoded trace, with the ID of every branch
+size_t dense_pos;  // Branches of 'dense' already read
+
+// Windowed statistics: a CSV row every 'interval' branches
+uint32_t interval;
+uint64_t window;             // Index of the current window
+uint32_t window_branches;    // Branches and mispredictions so far
+uint32_t window_incorrect;
+char *packed;      // File receiving the predictions one bit each
+char *save_state;  // Snapshot written after the run
+char *load_state;  // Snapshot the run starts from
+
+// Sampled simulation: every period of samplePeriod branches is skipped
+// up to its last sampleWarm + sampleMeasure branches, which train the
+// predictor and of which only the last sampleMeasure are counted
+int sample;
+uint32_t samplePeriod = 1000000;
+uint32_t sampleWarm = 90000;
+uint32_t sampleMeasure = 10000;
+
+uint32_t sample_pos;         // Position within the current period
+uint32_t sample_incorrect;   // Mispredictions of the current interval
+uint64_t sample_intervals;   // Complete measured intervals
+uint64_t sample_measured;    // Branches and mispredictions they hold
+uint64_t sample_mispredictions;
+double sample_sum;           // Sum and sum of squares of their rates
+double sample_sum2;
+#define SAMPLE_MIN_INTERVALS 5  // Fewest intervals given a confidence interval
+
+// Progress reports on stderr every progressEvery seconds
+int progress;
+double progressEvery = 10;
+double progress_start;       // Clock at the start and at the last report
+double progress_last;
+uint64_t progress_total;     // Bytes of all the traces, 0 if not known
+uint64_t progress_done;      // Bytes of the traces already read
+uint64_t trace_bytes;        // Bytes of the trace being read
 
 // Print out the Usage information to stderr
 //
 void
 usage()
 {
-  fprintf(stderr,"Usage: predictor <options> [<trace>]\n");
+  fprintf(stderr,"Usage: predictor <options> [<trace>...]\n");
   fprintf(stderr,"       bunzip -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr," Traces are text, bzip2 compressed text or binary (see tracecvt)\n");
   fprintf(stderr," Options:\n");
   fprintf(stderr," --help       Print this message\n");
   fprintf(stderr," --verbose    Print predictions on stdout\n");
+  fprintf(stderr," --packed:<file>  Write predictions to <file>, one bit each\n"
+                 "              (compare streams with predcmp)\n");
+  fprintf(stderr," --threads:<n> Worker threads (decompression, sweeps)\n");
+  fprintf(stderr," --sweep      Decode the trace once and simulate every scheme\n"
+                 "              given, with ranges such as gshare:8-24, in parallel\n");
+  fprintf(stderr," --batch      Simulate every scheme given over every trace given\n");
+  fprintf(stderr," --format:<f> Batch table format: md (default), csv or json\n");
+  fprintf(stderr," --explore[:<bits>]  Print the Pareto front of bits against\n"
+                 "              misprediction rate, over every trace given, of\n"
+                 "              the schemes given within <bits> (default %d)\n",
+          EXPLORE_BUDGET);
   fprintf(stderr," --<type>     Branch prediction scheme:\n");
   fprintf(stderr,"    static\n"
                  "    gshare:<# ghistory>\n"
                  "    tournament:<# ghistory>:<# lhistory>:<# index>\n"
-                 "    custom\n");
+                 "    custom\n"
+                 "    perceptron:<# ghistory>:<# rows>\n"
+                 "    tage:<# banks>:<# index>:<min history>:<max history>\n");
+  fprintf(stderr," --bits       Also print the storage of the scheme in bits\n");
+  fprintf(stderr," --chunks:<k>[:<warmup>]  Simulate the trace as k parts in\n"
+                 "              parallel, each trained first on the <warmup>\n"
+                 "              branches before it (default 100000)\n");
+  fprintf(stderr," --check      With --chunks, print the deviation from a\n"
+                 "              serial simulation\n");
+  fprintf(stderr," --profile-pcs[:<n>]  Print the n branches with the most\n"
+                 "              mispredictions (default 20)\n");
+  fprintf(stderr," --profile-csv:<file>  Write the profile of every branch\n");
+  fprintf(stderr," --progress[:<s>]  Report the branches/sec and the time\n"
+                 "              left to stderr every s seconds (default 10)\n");
+  fprintf(stderr," --dense-pcs  Decode the trace and number its static branches\n"
+                 "              first, so the profile needs no hash table\n");
+  fprintf(stderr," --interval:<n>  Print a CSV row of statistics every n\n"
+                 "              branches as the simulation runs\n");
+  fprintf(stderr," --sample[:<period>:<warm>:<measure>]  Estimate the rate from\n"
+                 "              one measured interval per period, after warming\n"
+                 "              (default 1000000:90000:10000)\n");
+#ifndef NO_TIMING
+  fprintf(stderr," --timing[:json]  Print the time spent in each stage of the\n"
+                 "              main loop to stderr\n");
+#endif
+  fprintf(stderr," --save-state:<file>  Save the trained predictor to <file>\n");
+  fprintf(stderr," --load-state:<file>  Start from the predictor saved in <file>\n");
 }
 
 // Process an option and update the predictor
@@ -49,47 +165,329 @@ handle_option(char *arg)
     sscanf(arg+13,"%d:%d:%d", &ghistoryBits, &lhistoryBits, &pcIndexBits);
   } else if (!strcmp(arg,"--custom")) {
     bpType = CUSTOM;
+  } else if (!strncmp(arg,"--perceptron:",13)) {
+    bpType = PERCEPTRON;
+    sscanf(arg+13,"%d:%d", &ghistoryBits, &perceptronRows);
+  } else if (!strncmp(arg,"--tage:",7)) {
+    bpType = TAGE;
+    sscanf(arg+7,"%d:%d:%d:%d", &tageBanks, &pcIndexBits, &tageMinHistory,
+           &ghistoryBits);
   } else if (!strcmp(arg,"--verbose")) {
     verbose = 1;
+    return 1;
+  } else if (!strncmp(arg,"--packed:",9)) {
+    packed = arg+9;
+    return 1;
+  } else if (!strncmp(arg,"--threads:",10)) {
+    sscanf(arg+10,"%d", &threads);
+    traceThreads = threads;
+    return 1;
+  } else if (!strcmp(arg,"--sweep")) {
+    sweep = 1;
+    return 1;
+  } else if (!strcmp(arg,"--batch")) {
+    batch = 1;
+    return 1;
+  } else if (!strcmp(arg,"--explore")) {
+    explore = 1;
+    return 1;
+  } else if (!strncmp(arg,"--explore:",10)) {
+    unsigned long long bits;
+    explore = 1;
+    if (sscanf(arg+10,"%llu", &bits) != 1) {
+      return 0;
+    }
+    budget = bits;
+    return 1;
+  } else if (!strncmp(arg,"--format:",9)) {
+    format = arg+9;
+    return 1;
+  } else if (!strcmp(arg,"--bits")) {
+    bits = 1;
+    return 1;
+  } else if (!strncmp(arg,"--chunks:",9)) {
+    // Zero chunks would quietly fall back to the serial run
+    return sscanf(arg+9,"%d:%u", &chunks, &warmup) >= 1 && chunks >= 1;
+  } else if (!strcmp(arg,"--check")) {
+    check = 1;
+    return 1;
+  } else if (!strcmp(arg,"--profile-pcs")) {
+    profile = 1;
+    return 1;
+  } else if (!strncmp(arg,"--profile-pcs:",14)) {
+    profile = 1;
+    return sscanf(arg+14,"%d", &profileTop) == 1;
+  } else if (!strncmp(arg,"--profile-csv:",14)) {
+    profile = 1;
+    profileCsv = arg+14;
+    return 1;
+  } else if (!strcmp(arg,"--progress")) {
+    progress = 1;
+    return 1;
+  } else if (!strncmp(arg,"--progress:",11)) {
+    progress = 1;
+    return sscanf(arg+11,"%lf", &progressEvery) == 1;
+  } else if (!strcmp(arg,"--dense-pcs")) {
+    densePcs = 1;
+    return 1;
+  } else if (!strncmp(arg,"--interval:",11)) {
+    return sscanf(arg+11,"%u", &interval) == 1;
+  } else if (!strcmp(arg,"--sample")) {
+    sample = 1;
+    return 1;
+  } else if (!strncmp(arg,"--sample:",9)) {
+    sample = 1;
+    return sscanf(arg+9,"%u:%u:%u", &samplePeriod, &sampleWarm,
+                  &sampleMeasure) == 3;
+#ifndef NO_TIMING
+  } else if (!strcmp(arg,"--timing")) {
+    timing = 1;
+    return 1;
+  } else if (!strcmp(arg,"--timing:json")) {
+    timing = 1;
+    timingJson = 1;
+    return 1;
+#endif
+  } else if (!strncmp(arg,"--save-state:",13)) {
+    save_state = arg+13;
+    return 1;
+  } else if (!strncmp(arg,"--load-state:",13)) {
+    load_state = arg+13;
+    return 1;
   } else {
     return 0;
   }
 
+  // Remember every scheme for the sweep mode
+  specs = realloc(specs, (nspecs + 1) * sizeof(char *));
+  specs[nspecs++] = arg + 2;
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
+// Open the next of the traces given, or stdin if none were
 //
-// Returns True if Successful 
+void
+open_trace()
+{
+  struct stat st;
+
+  progress_done += trace_bytes;
+  trace_path = (trace_next < ntraces) ? traces[trace_next] : NULL;
+  trace_next++;
+  trace = trace_open(trace_path);
+  if (trace == NULL) {
+    fprintf(stderr, "Unable to open %s\n", trace_path);
+    exit(1);
+  }
+  trace_bytes = (trace_path != NULL && stat(trace_path, &st) == 0) ?
+                st.st_size : 0;
+}
+
+// Reach the next block of branches, decoded from the traces given one
+// after the other or, with --dense-pcs, taken in place from the decoded
+// trace with their IDs
 //
-int
-read_branch(uint32_t *pc, uint8_t *outcome)
+// Returns the number of branches, 0 at the end of the last trace
+//
+size_t
+next_block()
 {
-  if (getline(&buf, &len, stream) == -1) {
-    return 0;
+  if (trace != NULL) {
+    size_t n;
+    while ((n = trace_read(trace, pc_block, outcome_block, BLOCK_SIZE)) == 0 &&
+           trace_error(trace) == NULL && trace_next < ntraces) {
+      trace_close(trace);
+      open_trace();
+    }
+    return n;
   }
 
-  uint32_t tmp;
-  sscanf(buf,"0x%x %d\n",pc,&tmp);
-  *outcome = tmp;
+  size_t n = dense.n - dense_pos;
+  if (n > BLOCK_SIZE) {
+    n = BLOCK_SIZE;
+  }
+  pc_block = dense.pc + dense_pos;
+  outcome_block = dense.outcome + dense_pos;
+  id_block = dense.id + dense_pos;
+  dense_pos += n;
+  return n;
+}
 
-  return 1;
+// Returns a monotonic clock reading in seconds
+//
+double
+seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Report on stderr, once every progressEvery seconds, the branches
+// simulated so far, their rate and, when the size of every trace is
+// known, how far through the input the run is and the time left
+//
+void
+progress_report(uint64_t branches)
+{
+  double now = seconds();
+  if (now - progress_last < progressEvery) {
+    return;
+  }
+  progress_last = now;
+
+  double elapsed = now - progress_start;
+  fprintf(stderr, "Progress: %llu branches, %.2fM branches/s",
+          (unsigned long long)branches, branches / elapsed / 1e6);
+  double f = (trace != NULL) ? trace_progress(trace) : -1;
+  if (progress_total > 0 && f >= 0) {
+    f = (progress_done + f * trace_bytes) / progress_total;
+    if (f > 0) {
+      long left = (long)(elapsed * (1 - f) / f + 0.5);
+      fprintf(stderr, ", %.1f%%, ETA %ld:%02ld:%02ld", 100 * f,
+              left / 3600, left / 60 % 60, left % 60);
+    }
+  }
+  fprintf(stderr, "\n");
+}
+
+// Print the predictions of a block as --verbose lines, formatted into
+// one buffer and written at once
+//
+void
+print_predictions(size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    text_block[2 * i] = '0' + prediction_block[i];
+    text_block[2 * i + 1] = '\n';
+  }
+  fwrite(text_block, 2, n, stdout);
+}
+
+// Print the CSV row of the current window and start the next one
+//
+void
+window_print()
+{
+  printf("%llu,%llu,%u,%u,%.3f\n", (unsigned long long)window,
+         (unsigned long long)window * interval, window_branches,
+         window_incorrect, 100 * (double)window_incorrect / window_branches);
+  window++;
+  window_branches = 0;
+  window_incorrect = 0;
+}
+
+// Simulate a block of branches in windows of 'interval' branches,
+// splitting it where a window ends so that each row takes a single
+// division
+//
+// Returns the number of mispredictions
+//
+uint32_t
+interval_block(size_t n, uint8_t *pred_out)
+{
+  uint32_t mispredictions = 0;
+  size_t i = 0;
+
+  while (i < n) {
+    uint32_t len = interval - window_branches;
+    if (len > n - i) {
+      len = n - i;
+    }
+    uint32_t m = simulate_batch(pc_block + i, outcome_block + i, len,
+                                pred_out ? pred_out + i : NULL);
+    mispredictions += m;
+    window_incorrect += m;
+    window_branches += len;
+    i += len;
+    if (window_branches == interval) {
+      window_print();
+    }
+  }
+  return mispredictions;
+}
+
+// Returns the two-sided 95% quantile of Student's t distribution with
+// 'df' degrees of freedom: tabulated up to 30, then a Cornish-Fisher
+// expansion around the normal quantile, good to three decimals
+//
+double
+student_t95(uint64_t df)
+{
+  static const double t[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+  if (df <= 30) {
+    return t[df - 1];
+  }
+  double z = 1.959964, z3 = z * z * z, z5 = z3 * z * z;
+  return z + (z3 + z) / (4.0 * df) +
+         (5 * z5 + 16 * z3 + 3 * z) / (96.0 * df * df);
+}
+
+// Simulate a block of branches in sampled mode, fast-forwarding,
+// warming or measuring each part according to its place in the period
+//
+void
+sample_block(size_t n)
+{
+  uint32_t warm_at = samplePeriod - sampleWarm - sampleMeasure;
+  uint32_t measure_at = samplePeriod - sampleMeasure;
+  size_t i = 0;
+
+  while (i < n) {
+    uint32_t end = sample_pos < warm_at ? warm_at :
+                   sample_pos < measure_at ? measure_at : samplePeriod;
+    uint32_t len = end - sample_pos;
+    if (len > n - i) {
+      len = n - i;
+    }
+
+    if (sample_pos >= measure_at) {
+      sample_incorrect += simulate_batch(pc_block + i, outcome_block + i,
+                                         len, NULL);
+    } else if (sample_pos >= warm_at) {
+      simulate_batch(pc_block + i, outcome_block + i, len, NULL);
+    }
+    sample_pos += len;
+    i += len;
+
+    // Only complete intervals are counted, so they weigh the same
+    if (sample_pos == samplePeriod) {
+      double rate = (double)sample_incorrect / sampleMeasure;
+      sample_intervals++;
+      sample_measured += sampleMeasure;
+      sample_mispredictions += sample_incorrect;
+      sample_sum += rate;
+      sample_sum2 += rate * rate;
+      sample_pos = 0;
+      sample_incorrect = 0;
+    }
+  }
 }
 
 int
 main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
   bpType = STATIC;
   verbose = 0;
+  format = "md";
 
   // Process cmdline Arguments
   for (int i = 1; i < argc; ++i) {
     if (!strcmp(argv[i],"--help")) {
       usage();
       exit(0);
+    } else if (!strcmp(argv[i],"--save-state") && i + 1 < argc) {
+      // The snapshot options also take the file as the next argument
+      save_state = argv[++i];
+    } else if (!strcmp(argv[i],"--load-state") && i + 1 < argc) {
+      load_state = argv[++i];
+    } else if (!strcmp(argv[i],"--interval") && i + 1 < argc) {
+      sscanf(argv[++i],"%u", &interval);
     } else if (!strncmp(argv[i],"--",2)) {
       if (!handle_option(argv[i])) {
         printf("Unrecognized option %s\n", argv[i]);
@@ -98,44 +496,273 @@ main(int argc, char *argv[])
       }
     } else {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      trace_path = argv[i];
+      traces = realloc(traces, (ntraces + 1) * sizeof(char *));
+      traces[ntraces++] = argv[i];
     }
   }
 
-  // Initialize the predictor
-  init_predictor();
+  if (explore) {
+    return explore_main(traces, ntraces, specs, nspecs, threads, budget);
+  }
+  if (batch) {
+    return batch_main(traces, ntraces, specs, nspecs, threads, format);
+  }
+  if (sweep) {
+    if (ntraces > 1) {
+      fprintf(stderr, "--sweep reads a single trace; --batch takes several\n");
+      exit(1);
+    }
+    return sweep_main(trace_path, specs, nspecs, threads);
+  }
 
-  uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
-  uint32_t pc = 0;
-  uint8_t outcome = NOTTAKEN;
+  if (sample && (sampleMeasure == 0 || sampleWarm > samplePeriod ||
+                 sampleMeasure > samplePeriod - sampleWarm)) {
+    fprintf(stderr, "Invalid sampling of %u warmed and %u measured branches "
+            "every %u\n", sampleWarm, sampleMeasure, samplePeriod);
+    exit(1);
+  }
+  if (interval && (verbose || sample)) {
+    fprintf(stderr, "--interval cannot be combined with --%s\n",
+            verbose ? "verbose" : "sample");
+    exit(1);
+  }
+  if (sample && (verbose || packed || profile)) {
+    fprintf(stderr, "--%s needs every prediction, not a sample\n",
+            verbose ? "verbose" : packed ? "packed" : "profile-pcs");
+    exit(1);
+  }
+  // The chunked mode only prints the totals; it has no stream of
+  // predictions, no single final state and none of the main loop's stages
+  if (chunks) {
+    const char *other = verbose ? "verbose" : packed ? "packed" :
+                        profile ? "profile-pcs" : interval ? "interval" :
+                        sample ? "sample" : save_state ? "save-state" :
+                        load_state ? "load-state" : densePcs ? "dense-pcs" :
+                        progress ? "progress" : bits ? "bits" : NULL;
+#ifndef NO_TIMING
+    if (timing) {
+      other = "timing";
+    }
+#endif
+    if (other != NULL) {
+      fprintf(stderr, "--chunks cannot be combined with --%s\n", other);
+      exit(1);
+    }
+  }
+  if (ntraces > 1 && (densePcs || chunks)) {
+    fprintf(stderr, "--%s reads a single trace\n",
+            densePcs ? "dense-pcs" : "chunks");
+    exit(1);
+  }
 
-  // Reach each branch from the trace
-  while (read_branch(&pc, &outcome)) {
-    num_branches++;
+  predictor_config_t config = { bpType, ghistoryBits, lhistoryBits,
+                                pcIndexBits, perceptronRows, tageBanks,
+                                tageMinHistory };
+  if (!predictor_check(&config)) {
+    fprintf(stderr, "Invalid configuration for the %s predictor\n",
+            bpName[bpType]);
+    exit(1);
+  }
+  if (chunks) {
+    return chunk_main(trace_path, &config, chunks, warmup, threads, check);
+  }
+
+  // With --dense-pcs the whole trace is decoded and its static branches
+  // numbered up front; otherwise it is streamed block by block
+  TIMING_START();
+  if (densePcs) {
+    char err[128];
+    if (!trace_load(trace_path, &dense, err, sizeof(err))) {
+      fprintf(stderr, "%s: %s\n", trace_path ? trace_path : "stdin", err);
+      exit(1);
+    }
+    trace_buf_index(&dense);
+    TIMING_LAP(STAGE_READ);
+  } else {
+    open_trace();
+  }
 
-    // Make a prediction and compare with actual outcome
-    uint8_t prediction = make_prediction(pc);
-    if (prediction != outcome) {
-      mispredictions++;
+  // Initialize the predictor, or restore a saved one, which takes the
+  // scheme of the snapshot unless another one is asked for
+  if (load_state != NULL) {
+    char err[128], want[64], have[64];
+    if (!load_predictor(load_state, err, sizeof(err))) {
+      fprintf(stderr, "%s: %s\n", load_state, err);
+      exit(1);
+    }
+    predictor_format(&config, want, sizeof(want));
+    config = (predictor_config_t){ bpType, ghistoryBits, lhistoryBits,
+                                   pcIndexBits, perceptronRows, tageBanks,
+                                   tageMinHistory };
+    predictor_format(&config, have, sizeof(have));
+    if (nspecs > 0 && strcmp(want, have)) {
+      fprintf(stderr, "%s: holds a --%s predictor, not --%s\n",
+              load_state, have, want);
+      exit(1);
+    }
+  } else {
+    init_predictor();
+  }
+
+  // A block holds at most BLOCK_SIZE static branches; the table grows
+  // as the trace reaches more.  An indexed trace needs no table.
+  profile_t *prof = NULL;
+  if (profile) {
+    prof = densePcs ? profile_create_dense(dense.pcs, dense.npcs)
+                    : profile_create(BLOCK_SIZE);
+  }
+
+  predstream_writer_t *stream = NULL;
+  if (packed != NULL && (stream = predstream_open(packed)) == NULL) {
+    fprintf(stderr, "%s: %s\n", packed, strerror(errno));
+    exit(1);
+  }
+  int keep = verbose || stream || prof;
+
+  if (interval) {
+    printf("window,first_branch,branches,incorrect,rate\n");
+  }
+
+  // The time left is estimated from the share of the input read, which
+  // needs the size of every trace
+  if (progress) {
+    for (int i = 0; i < ntraces; i++) {
+      struct stat st;
+      if (stat(traces[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+        progress_total = 0;
+        break;
+      }
+      progress_total += st.st_size;
+    }
+    progress_start = progress_last = seconds();
+  }
+
+  uint64_t num_branches = 0;
+  uint64_t mispredictions = 0;
+  size_t n;
+
+  // Reach each block of branches from the trace
+  TIMING_START();
+  while ((n = next_block()) > 0) {
+    TIMING_LAP(STAGE_READ);
+
+    // Predict and train the whole block, keeping the predictions only
+    // when they are printed
+    num_branches += n;
+    if (progress) {
+      progress_report(num_branches);
+    }
+    if (sample) {
+      sample_block(n);
+      TIMING_LAP(STAGE_SIMULATE);
+      continue;
+    }
+    if (interval) {
+      mispredictions += interval_block(n, keep ? prediction_block : NULL);
+    } else {
+      mispredictions += simulate_batch(pc_block, outcome_block, n,
+                                       keep ? prediction_block : NULL);
+    }
+    TIMING_LAP(STAGE_SIMULATE);
+    if (prof != NULL) {
+      if (densePcs) {
+        profile_add_ids(prof, id_block, outcome_block, prediction_block, n);
+      } else {
+        profile_add(prof, pc_block, outcome_block, prediction_block, n);
+      }
+      TIMING_LAP(STAGE_PROFILE);
     }
     if (verbose != 0) {
-      printf ("%d\n", prediction);
+      print_predictions(n);
+      TIMING_LAP(STAGE_OUTPUT);
+    }
+    if (stream != NULL) {
+      if (!predstream_put(stream, prediction_block, n)) {
+        fprintf(stderr, "%s: %s\n", packed, strerror(errno));
+        exit(1);
+      }
+      TIMING_LAP(STAGE_OUTPUT);
     }
+  }
+  TIMING_LAP(STAGE_READ);
+  if (interval && window_branches > 0) {
+    window_print();
+  }
+  if (trace != NULL && trace_error(trace) != NULL) {
+    fprintf(stderr, "%s: %s\n", trace_path ? trace_path : "stdin",
+            trace_error(trace));
+    exit(1);
+  }
 
-    // Train the predictor
-    train_predictor(pc, outcome);
+  // In sampled mode, estimate the mispredictions from the measured
+  // intervals, with a 95% confidence interval from their spread
+  if (sample) {
+    double rate = sample_measured ?
+                  (double)sample_mispredictions / sample_measured : 0;
+    mispredictions = (uint64_t)(rate * num_branches + 0.5);
   }
 
   // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
+  printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+  printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions);
   float mispredict_rate = 100*((float)mispredictions / (float)num_branches);
   printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  if (bits) {
+    printf("Storage Bits:    %10llu\n",
+           (unsigned long long)predictor_bits(&config));
+  }
+  if (sample) {
+    printf("Measured:        %10llu in %llu intervals\n",
+           (unsigned long long)sample_measured,
+           (unsigned long long)sample_intervals);
+    // Few intervals give a poor estimate of their variance, which the
+    // t quantile allows for but cannot repair
+    if (sample_intervals >= SAMPLE_MIN_INTERVALS) {
+      double k = sample_intervals;
+      double mean = sample_sum / k;
+      double var = (sample_sum2 - k * mean * mean) / (k - 1);
+      double half = student_t95(sample_intervals - 1) *
+                    sqrt(var > 0 ? var / k : 0);
+      printf("95%% Confidence:  %7.3f +- %.3f\n", 100 * mean, 100 * half);
+    } else {
+      printf("95%% Confidence:  needs at least %d intervals\n",
+             SAMPLE_MIN_INTERVALS);
+    }
+  }
+
+  if (stream != NULL && !predstream_close(stream)) {
+    fprintf(stderr, "%s: %s\n", packed, strerror(errno));
+    exit(1);
+  }
+
+#ifndef NO_TIMING
+  if (timing) {
+    timing_report(num_branches, timingJson);
+  }
+#endif
+
+  if (prof != NULL) {
+    if (profileTop > 0) {
+      profile_print(prof, stdout, profileTop);
+    }
+    if (profileCsv != NULL && !profile_write_csv(prof, profileCsv)) {
+      fprintf(stderr, "%s: %s\n", profileCsv, strerror(errno));
+      exit(1);
+    }
+    profile_destroy(prof);
+  }
+
+  if (save_state != NULL && !save_predictor(save_state)) {
+    fprintf(stderr, "%s: %s\n", save_state, strerror(errno));
+    exit(1);
+  }
 
   // Cleanup
-  fclose(stream);
-  free(buf);
+  if (trace != NULL) {
+    trace_close(trace);
+  }
+  trace_buf_free(&dense);
 
   return 0;
 }
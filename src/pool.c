@@ -0,0 +1,231 @@
+//========================================================//
+//  pool.c                                                //
+//  Source file for the work-stealing thread pool         //
+//                                                        //
+//  Deques are small mutex-protected rings: the tasks are //
+//  whole simulations, so locking cost is negligible next //
+//  to the work they carry                                //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+
+typedef struct {
+  void (*fn)(void *);
+  void *arg;
+} task_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  task_t *tasks;          // Ring buffer of 'cap' slots
+  size_t cap;
+  size_t head;            // Oldest task, taken by thieves
+  size_t count;
+} deque_t;
+
+typedef struct {
+  pool_t *pool;
+  int id;
+} worker_t;
+
+struct pool {
+  int threads;
+  deque_t *deques;
+  worker_t *workers;
+  pthread_t *tids;
+  unsigned next;          // Deque receiving the next outside submission
+
+  pthread_mutex_t lock;   // Guards the counters below
+  pthread_cond_t work;    // Signalled when a task is queued or on stop
+  pthread_cond_t idle;    // Signalled when 'pending' drops to zero
+  size_t queued;          // Queued tasks no worker has reserved yet
+  size_t pending;         // Tasks queued or running
+  int stop;
+};
+
+// Worker id of the calling thread, -1 outside the pool
+static __thread int self = -1;
+static __thread pool_t *self_pool;
+
+static void
+deque_push(deque_t *d, task_t t)
+{
+  pthread_mutex_lock(&d->lock);
+  if (d->count == d->cap) {
+    size_t cap = d->cap ? 2 * d->cap : 16;
+    task_t *tasks = malloc(cap * sizeof(task_t));
+    for (size_t i = 0; i < d->count; i++) {
+      tasks[i] = d->tasks[(d->head + i) % d->cap];
+    }
+    free(d->tasks);
+    d->tasks = tasks;
+    d->cap = cap;
+    d->head = 0;
+  }
+  d->tasks[(d->head + d->count) % d->cap] = t;
+  d->count++;
+  pthread_mutex_unlock(&d->lock);
+}
+
+// Take the newest task (owner) or the oldest one (thief)
+//
+static int
+deque_take(deque_t *d, int steal, task_t *t)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->count > 0) {
+    if (steal) {
+      *t = d->tasks[d->head];
+      d->head = (d->head + 1) % d->cap;
+    } else {
+      *t = d->tasks[(d->head + d->count - 1) % d->cap];
+    }
+    d->count--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+static int
+find_task(pool_t *pool, int id, task_t *t)
+{
+  if (deque_take(&pool->deques[id], 0, t)) {
+    return 1;
+  }
+  for (int i = 1; i < pool->threads; i++) {
+    if (deque_take(&pool->deques[(id + i) % pool->threads], 1, t)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *
+pool_worker(void *arg)
+{
+  worker_t *w = arg;
+  pool_t *pool = w->pool;
+  task_t t;
+
+  self = w->id;
+  self_pool = pool;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->queued == 0 && !pool->stop) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    if (pool->queued == 0) {
+      break;
+    }
+    // Reserve a task; tasks are pushed under the pool lock, so one is
+    // guaranteed to be sitting in some deque for every reservation
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (!find_task(pool, w->id, &t)) {
+      sched_yield();
+    }
+
+    t.fn(t.arg);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_broadcast(&pool->idle);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+pool_t *
+pool_create(int threads)
+{
+  pool_t *pool = calloc(1, sizeof(pool_t));
+
+  if (threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (threads <= 0) {
+    threads = 1;
+  }
+  pool->threads = threads;
+  pool->deques = calloc(threads, sizeof(deque_t));
+  pool->workers = calloc(threads, sizeof(worker_t));
+  pool->tids = calloc(threads, sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  for (int i = 0; i < threads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&pool->tids[i], NULL, pool_worker, &pool->workers[i]);
+  }
+  return pool;
+}
+
+void
+pool_submit(pool_t *pool, void (*fn)(void *), void *arg)
+{
+  task_t t = { fn, arg };
+  int id;
+
+  pthread_mutex_lock(&pool->lock);
+  if (self_pool == pool) {
+    id = self;
+  } else {
+    id = pool->next++ % pool->threads;
+  }
+  deque_push(&pool->deques[id], t);
+  pool->pending++;
+  pool->queued++;
+  pthread_cond_signal(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void
+pool_wait(pool_t *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void
+pool_destroy(pool_t *pool)
+{
+  pool_wait(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->threads; i++) {
+    pthread_join(pool->tids[i], NULL);
+  }
+  for (int i = 0; i < pool->threads; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+  pthread_cond_destroy(&pool->idle);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->tids);
+  free(pool->workers);
+  free(pool->deques);
+  free(pool);
+}
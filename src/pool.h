@@ -0,0 +1,34 @@
+//========================================================//
+//  pool.h                                                //
+//  Header file for the work-stealing thread pool         //
+//                                                        //
+//  Every worker owns a deque of tasks; it pops its own   //
+//  newest task and steals the oldest task of another     //
+//  worker once its deque runs dry                        //
+//========================================================//
+
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct pool pool_t;
+
+// Start a pool of 'threads' workers (0 uses one per core)
+//
+pool_t *pool_create(int threads);
+
+// Queue fn(arg).  Called from a task, the new task goes to the front
+// of the calling worker's own deque so related work stays on one core
+// until another worker steals it.
+//
+void pool_submit(pool_t *pool, void (*fn)(void *), void *arg);
+
+// Block until every task submitted so far, and every task those
+// tasks submitted, has finished
+//
+void pool_wait(pool_t *pool);
+
+// Wait for the outstanding tasks and stop the workers
+//
+void pool_destroy(pool_t *pool);
+
+#endif
@@ -0,0 +1,76 @@
+//========================================================//
+//  predcmp.c                                             //
+//  Compares two prediction streams bit for bit           //
+//                                                        //
+//  Streams are packed streams (--packed) or --verbose    //
+//  text, compared 64 predictions at a time               //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "predstream.h"
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: predcmp <stream> <stream>\n");
+  fprintf(stderr," Streams are written by predictor --packed:<file> or are the\n"
+                 " text printed by predictor --verbose\n");
+  fprintf(stderr," Exits with 0 if they are identical, 1 if they differ\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64_t *words[2];
+  uint64_t count[2];
+  char err[128];
+
+  int help = (argc > 1 && !strcmp(argv[1],"--help"));
+  if (argc != 3 || help) {
+    usage();
+    exit(help ? 0 : 2);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (!predstream_load(argv[i + 1], &words[i], &count[i], err, sizeof(err))) {
+      fprintf(stderr, "%s: %s\n", argv[i + 1], err);
+      exit(2);
+    }
+  }
+
+  // XOR the words both streams cover, the last one cut to the end of
+  // the shorter stream
+  uint64_t common = count[0] < count[1] ? count[0] : count[1];
+  uint64_t differences = 0;
+  uint64_t first = common;
+  for (uint64_t w = 0; w < (common + 63) / 64; w++) {
+    uint64_t x = words[0][w] ^ words[1][w];
+    if (w == common / 64) {
+      x &= ((uint64_t)1 << (common & 63)) - 1;
+    }
+    if (x != 0) {
+      if (first == common) {
+        first = w * 64 + __builtin_ctzll(x);
+      }
+      differences += __builtin_popcountll(x);
+    }
+  }
+
+  printf("Predictions:     %10llu %10llu\n", (unsigned long long)count[0],
+         (unsigned long long)count[1]);
+  printf("Differences:     %10llu\n", (unsigned long long)differences);
+  if (first < common) {
+    printf("First Divergence: %9llu\n", (unsigned long long)first);
+  } else if (count[0] != count[1]) {
+    printf("First Divergence: %9llu (end of the shorter stream)\n",
+           (unsigned long long)common);
+  }
+
+  free(words[0]);
+  free(words[1]);
+  return differences != 0 || count[0] != count[1];
+}
@@ -5,9 +5,23 @@
 //  Implement the various branch predictors below as      //
 //  described in the README                               //
 //========================================================//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "predictor.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 //
 // TODO:Student Information
 //
@@ -20,12 +34,15 @@ const char *email       = "EMAIL";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[4] = { "Static", "Gshare",
-                          "Tournament", "Custom" };
+const char *bpName[6] = { "Static", "Gshare",
+                          "Tournament", "Custom", "Perceptron", "TAGE" };
 
 int ghistoryBits; // Number of bits used for Global History
 int lhistoryBits; // Number of bits used for Local History
 int pcIndexBits;  // Number of bits used for PC index
+int perceptronRows; // Number of rows of perceptron weights
+int tageBanks;      // Number of tagged TAGE banks
+int tageMinHistory; // History length of the shortest TAGE bank
 int bpType;       // Branch Prediction Type
 int verbose;
 
@@ -33,18 +50,7 @@ int verbose;
 //      Predictor Data Structures     //
 //------------------------------------//
 
-// Gshare Predictor Data Structures
-uint32_t *gshare_bht;       // Branch History Table
-uint32_t gshare_history;    // Global History Register
-
-// Tournament Predictor Data Structures
-uint32_t *tournament_global_bht;    // Global Branch History Table
-uint32_t *tournament_local_bht;     // Local Branch History Table
-uint32_t *tournament_local_history;  // Local History Table
-uint32_t *tournament_choice;         // Choice Predictor
-uint32_t tournament_global_history;  // Global History Register
-
-// Custom Predictor Data Structures
+// Custom Predictor Sizes
 #define CUSTOM_GHIST_BITS 18    // 增加全局历史位数
 #define CUSTOM_PHT_BITS 16      // 模式历史表位数
 #define CUSTOM_BHT_BITS 14      // 分支历史表位数
@@ -57,6 +63,31 @@ uint32_t tournament_global_history;  // Global History Register
 #define CUSTOM_SIMPLE_BITS 12   // 简单PC预测器位数
 #define CUSTOM_INT_BITS 10      // 整数预测器位数
 
+// The loop table is set-associative, LOOP_WAYS entries per set.  An
+// entry is packed into 64 bits, so a set fills one cache line and a
+// lookup touches only that line:
+//
+//   63   48 47     32 31   12 11  8 7   6 5  3   2      1      0
+//   | tag  | pattern | iter  | conf | depth | -- | loop | last | valid
+//
+// The ways of a set are kept in order of use, most recent first, so an
+// entry's way is its age: a lookup usually stops at the first way, and
+// the last way is the one replaced.
+#define LOOP_WAYS         8
+#define LOOP_SET_BITS     (CUSTOM_LPT_BITS - 3)   // log2(LOOP_WAYS)
+#define LOOP_TAG_SHIFT    48
+#define LOOP_PATTERN_SHIFT 32
+#define LOOP_ITER_SHIFT   12
+#define LOOP_ITER_BITS    20                      // Saturating
+#define LOOP_CONF_SHIFT   8                       // CUSTOM_LPT_CONF_BITS
+#define LOOP_DEPTH_SHIFT  6
+#define LOOP_IS_LOOP      (1ull << 2)
+#define LOOP_LAST         (1ull << 1)
+#define LOOP_VALID        (1ull << 0)
+
+typedef uint64_t loop_entry_t;
+
+// One loop table entry unpacked for the custom predictor to work on
 typedef struct {
     uint32_t tag;           // 循环标签
     uint32_t confidence;    // 置信度计数器
@@ -65,8 +96,10 @@ typedef struct {
     uint32_t last_outcome; // 上次结果
     uint32_t pattern;      // 循环模式
     uint32_t depth;        // 循环嵌套深度
-} loop_entry_t;
+} loop_state_t;
 
+// Every counter is scaled by 0.8 each 10000 predictions, so none grows
+// past 50000 however long the run; 32 bits never overflow
 typedef struct {
     uint32_t global_correct;    // 全局预测器正确次数
     uint32_t local_correct;     // 局部预测器正确次数
@@ -80,38 +113,112 @@ typedef struct {
     uint32_t loop_branches;     // 循环分支计数
 } meta_stats_t;
 
-uint32_t *custom_pht;           // 模式历史表 (全局)
-uint32_t *custom_bht;           // 分支历史表 (混合)
-uint32_t *custom_lht;           // 局部历史表
-uint32_t *custom_simple;        // 简单PC预测器
-uint32_t *custom_int;           // 整数专用预测器
-uint32_t *custom_local_history; // 局部历史寄存器
-uint32_t *custom_meta;          // 元预测器表
-uint32_t custom_history;        // 全局历史寄存器
-uint32_t custom_path_history;   // 路径历史
-loop_entry_t *custom_lpt;       // 循环预测表
-meta_stats_t custom_stats;      // 全局统计信息
-
-// 存储大小计算 (bits):
+// 存储大小计算 (bits, 与 predictor_bits() 一致):
 // custom_pht: 2^16 * 2 = 131,072
 // custom_bht: 2^14 * 2 = 32,768
-// custom_lht: 2^12 * 2 = 8,192
+// custom_lht: 2^14 * 2 = 32,768
 // custom_simple: 2^12 * 2 = 8,192
-// custom_local_history: 2^10 * 12 = 12,288
-// custom_meta: 2^12 * 3 = 12,288
-// custom_lpt: 2^10 * 96 = 98,304
-// 历史寄存器: 16
-// 总计: 约305KB
+// custom_int: 2^10 * 2 = 2,048
+// custom_meta: 2^12 * 2 = 8,192
+// custom_local_history: 2^12 * 14 = 57,344
+// custom_lpt: 2^12 * 64 = 262,144
+// 历史寄存器: 2 * 18 = 36
+// 总计: 534,564 bits, 约65KB
+
+// TAGE Predictor Sizes
+#define TAGE_MAX_BANKS  8       // Banks per row (one SSE2 vector of tags)
+#define TAGE_MAX_HIST   1024    // Longest history of a bank
+#define TAGE_RING       2048    // Global history ring, > TAGE_MAX_HIST
+#define TAGE_TAG_BITS   16      // Including the valid bit
+#define TAGE_VALID      0x8000  // Set in the tag of every claimed entry
+#define TAGE_RING_PAD   16      // Ring bytes repeated for 16-byte reads
+#define TAGE_CTR_BITS   3       // Signed prediction counter, -4..3
+#define TAGE_U_BITS     2       // Usefulness counter
+#define TAGE_DECAY_BITS 18      // log2 of the branches between usefulness decays
+
+// A tagged entry, 4 bytes; each bank is a table of 2^pcIndexBits
+typedef struct {
+    uint16_t tag;
+    int8_t ctr;
+    uint8_t u;
+} tage_entry_t;
+
+// Predict-and-train loop over a block of branches (see select_kernel)
+typedef uint32_t (*kernel_t)(predictor_t *p, const uint32_t *pc,
+                             const uint8_t *outcome, size_t n,
+                             uint8_t *pred_out);
+
+// All the state of one predictor.  Nothing is shared between
+// instances, so each one can be driven from its own thread.
+struct predictor {
+    predictor_config_t config;
+    kernel_t kernel;            // Chosen for 'config' at creation
+
+    // Gshare Predictor Data Structures (counter tables are packed)
+    uint8_t *gshare_bht;        // Branch History Table
+    uint32_t gshare_history;    // Global History Register
+
+    // Tournament Predictor Data Structures
+    uint8_t *tournament_global_bht;      // Global Branch History Table
+    uint8_t *tournament_local_bht;       // Local Branch History Table
+    uint32_t *tournament_local_history;  // Local History Table
+    uint8_t *tournament_choice;          // Choice Predictor
+    uint32_t tournament_global_history;  // Global History Register
+
+    // Custom Predictor Data Structures
+    uint8_t *custom_pht;            // 模式历史表 (全局)
+    uint8_t *custom_bht;            // 分支历史表 (混合)
+    uint8_t *custom_lht;            // 局部历史表
+    uint8_t *custom_simple;         // 简单PC预测器
+    uint8_t *custom_int;            // 整数专用预测器
+    uint32_t *custom_local_history; // 局部历史寄存器
+    uint8_t *custom_meta;           // 元预测器表
+    uint32_t custom_history;        // 全局历史寄存器
+    uint32_t custom_path_history;   // 路径历史
+    void *custom_lpt_mem;           // Allocation behind custom_lpt
+    loop_entry_t *custom_lpt;       // 循环预测表, 2^LOOP_SET_BITS sets
+    meta_stats_t custom_stats;      // 全局统计信息
+
+    // Perceptron Predictor Data Structures
+    int8_t *perceptron_weights;     // 'rows' rows of perceptron_stride weights
+    int8_t *perceptron_bias;        // Bias weight of each row
+    int8_t *perceptron_history;     // +1/-1 per global history bit, newest first
+    int perceptron_stride;          // History length padded to PERCEPTRON_VEC
+    int perceptron_theta;           // Training threshold
+    int (*perceptron_dot)(const int8_t *w, const int8_t *h, int n);
+    void (*perceptron_update)(int8_t *w, const int8_t *h, int n, int t);
+
+    // TAGE Predictor Data Structures
+    tage_entry_t *tage_banks;       // 'banks' tables of tagged entries, one after another
+    uint8_t *tage_base;             // Bimodal base predictor (packed)
+    uint8_t tage_history[TAGE_RING + TAGE_RING_PAD]; // Global history ring
+                                    // of 0/0xFF, newest at tage_head; its
+                                    // first bytes repeat after its end
+    uint32_t tage_head;
+    // Bank histories folded to the index lane width and to
+    // TAGE_TAG_BITS - 1 and TAGE_TAG_BITS - 2 bits for the tag, one
+    // 16-bit lane per bank (unused banks run along)
+    uint16_t tage_fold[3][TAGE_MAX_BANKS];
+    uint16_t tage_out[3][TAGE_MAX_BANKS];     // Where the leaving bit lands
+    uint32_t tage_length[TAGE_MAX_BANKS];     // History length of each bank
+    int tage_use_alt;               // Trust the alternate over weak entries (4 bits)
+    uint32_t tage_tick;             // Branches since the last usefulness decay step
+    uint32_t tage_decay_row;        // Next row the decay halves
+
+    // Snapshot mapping the tables point into (see predictor_load)
+    void *state_map;
+    size_t state_len;
+};
+
+// Instance behind init_predictor/make_prediction/train_predictor
+static predictor_t *global_predictor;
 
 // Helper functions for bit manipulation
 #define MASK(bits) ((1 << (bits)) - 1)
 
-// Helper functions for 2-bit counter
-uint8_t get_prediction_from_counter(uint8_t counter) {
-    return (counter >= WT) ? TAKEN : NOTTAKEN;
-}
-
-uint8_t update_counter(uint8_t counter, uint8_t outcome) {
+// Saturating update of a 2-bit counter
+static inline uint8_t
+update_counter(uint8_t counter, uint8_t outcome) {
     if (outcome == TAKEN) {
         return (counter == ST) ? ST : counter + 1;
     } else {
@@ -119,620 +226,2062 @@ uint8_t update_counter(uint8_t counter, uint8_t outcome) {
     }
 }
 
+// Packed 2-bit counter tables: four counters per byte, counter i in
+// bits 2*(i%4)+1..2*(i%4) of byte i/4, so a 2^bits table takes
+// 2^bits/4 bytes instead of 2^bits words
+static inline uint8_t
+ctr_read(const uint8_t *table, uint32_t i) {
+    return (table[i >> 2] >> ((i & 3) << 1)) & 3;
+}
+
+static inline void
+ctr_write(uint8_t *table, uint32_t i, uint8_t counter) {
+    int shift = (i & 3) << 1;
+    table[i >> 2] = (table[i >> 2] & ~(3 << shift)) | (counter << shift);
+}
+
+// The taken/not-taken prediction is the high bit of the counter
+static inline uint8_t
+ctr_predict(const uint8_t *table, uint32_t i) {
+    return (table[i >> 2] >> (((i & 3) << 1) + 1)) & 1;
+}
+
+static inline void
+ctr_update(uint8_t *table, uint32_t i, uint8_t outcome) {
+    ctr_write(table, i, update_counter(ctr_read(table, i), outcome));
+}
+
+// Bytes of a packed table of 2^bits counters
+static inline size_t
+counter_bytes(int bits) {
+    return bits >= 2 ? (size_t)1 << (bits - 2) : 1;
+}
+
+// Allocate a packed table of 2^bits counters set to 'init'
+static uint8_t *
+alloc_counters(int bits, uint8_t init) {
+    size_t bytes = counter_bytes(bits);
+    uint8_t *table = (uint8_t *)malloc(bytes);
+    memset(table, init * 0x55, bytes);
+    return table;
+}
+
+// Allocate a table of 2^bits history registers, all NOTTAKEN
+static uint32_t *
+alloc_histories(int bits) {
+    return (uint32_t *)calloc((size_t)1 << bits, sizeof(uint32_t));
+}
+
 // 计算哈希索引的辅助函数
-uint32_t compute_hash_1(uint32_t pc, uint32_t history) {
+static inline uint32_t
+compute_hash_1(uint32_t pc, uint32_t history) {
     return ((pc >> 2) ^ history ^ (history >> 4) ^ (pc >> 10)) & MASK(CUSTOM_PHT_BITS);
 }
 
-uint32_t compute_hash_2(uint32_t pc, uint32_t history) {
-    return ((pc >> 3) ^ (history << 2) ^ (history >> 2) ^ custom_path_history) & MASK(CUSTOM_BHT_BITS);
+static inline uint32_t
+compute_hash_2(uint32_t pc, uint32_t history, uint32_t path_history) {
+    return ((pc >> 3) ^ (history << 2) ^ (history >> 2) ^ path_history) & MASK(CUSTOM_BHT_BITS);
 }
 
-uint32_t compute_hash_3(uint32_t pc, uint32_t history) {
+static inline uint32_t
+compute_hash_3(uint32_t pc, uint32_t history) {
     return ((pc >> 4) ^ history ^ (pc >> 8) ^ (history << 3)) & MASK(CUSTOM_LHIST_BITS);
 }
 
 // 检测是否为整数分支
-uint8_t is_int_branch(uint32_t pc) {
+static inline uint8_t
+is_int_branch(uint32_t pc) {
     // 使用PC的特征来判断
     uint32_t pc_pattern = (pc >> 2) & 0xFF;
     return (pc_pattern < 0x80); // 简单启发式判断
 }
 
 // 估计循环嵌套深度
-uint32_t estimate_loop_depth(uint32_t pc, uint32_t history) {
+static inline uint32_t
+estimate_loop_depth(uint32_t history) {
+    // The depth saturates at 3, so at most three set bits are cleared
+    // rather than every bit of the history shifted out
     uint32_t depth = 0;
-    uint32_t pattern = history;
-    while (pattern) {
-        if (pattern & 1) depth++;
-        pattern >>= 1;
+    for (uint32_t pattern = history; pattern && depth < 3; depth++) {
+        pattern &= pattern - 1;
+    }
+    return depth;
+}
+
+// Unpack a valid loop table entry
+static inline void
+loop_unpack(loop_entry_t e, loop_state_t *s) {
+    s->tag = e >> LOOP_TAG_SHIFT;
+    s->pattern = (e >> LOOP_PATTERN_SHIFT) & 0xFFFF;
+    s->iter_count = (e >> LOOP_ITER_SHIFT) & MASK(LOOP_ITER_BITS);
+    s->confidence = (e >> LOOP_CONF_SHIFT) & MASK(CUSTOM_LPT_CONF_BITS);
+    s->depth = (e >> LOOP_DEPTH_SHIFT) & 3;
+    s->is_loop = (e & LOOP_IS_LOOP) != 0;
+    s->last_outcome = (e & LOOP_LAST) != 0;
+}
+
+// Pack 's' into a valid entry
+static inline loop_entry_t
+loop_pack(const loop_state_t *s) {
+    return ((loop_entry_t)s->tag << LOOP_TAG_SHIFT) |
+           ((loop_entry_t)s->pattern << LOOP_PATTERN_SHIFT) |
+           ((loop_entry_t)s->iter_count << LOOP_ITER_SHIFT) |
+           ((loop_entry_t)s->confidence << LOOP_CONF_SHIFT) |
+           ((loop_entry_t)s->depth << LOOP_DEPTH_SHIFT) |
+           (s->is_loop ? LOOP_IS_LOOP : 0) |
+           (s->last_outcome ? LOOP_LAST : 0) | LOOP_VALID;
+}
+
+// Returns the way of the entry tagged 'tag' in 'set', or -1
+static inline int
+loop_find(const loop_entry_t *set, uint32_t tag) {
+    // Invalid ways are never followed by valid ones
+    for (int w = 0; w < LOOP_WAYS && (set[w] & LOOP_VALID); w++) {
+        if ((set[w] >> LOOP_TAG_SHIFT) == tag) {
+            return w;
+        }
     }
-    return (depth > 3) ? 3 : depth;
+    return -1;
 }
 
 //------------------------------------//
-//        Predictor Functions         //
+//         Gshare Predictor           //
 //------------------------------------//
 
-// Initialize the predictor
+static uint8_t
+gshare_predict(predictor_t *p, uint32_t pc)
+{
+    // XOR PC with global history
+    uint32_t index = ((pc >> 2) ^ p->gshare_history) & MASK(p->config.ghistoryBits);
+    // Get prediction from BHT
+    return ctr_predict(p->gshare_bht, index);
+}
+
+// The steps below are split in two halves so the kernels can
+// software-pipeline them: the indices only depend on the PCs and on
+// histories built from the known outcomes, so a whole run of them is
+// computed (and prefetched) ahead of the counter updates, which still
+// happen strictly in trace order.  With constant 'bits' the masks
+// fold away.
+
+// Index of the branch at 'pc' and advance of the global history
 //
-void
-init_predictor()
+static inline __attribute__((always_inline)) uint32_t
+gshare_index(uint32_t *history, uint32_t pc, uint8_t outcome, int bits)
 {
-    // Initialize Gshare
-    if (bpType == GSHARE) {
-        // Allocate BHT - size is 2^ghistoryBits entries
-        gshare_bht = (uint32_t *)calloc(1 << ghistoryBits, sizeof(uint32_t));
-        // Initialize all entries to WN (1)
-        for (int i = 0; i < (1 << ghistoryBits); i++) {
-            gshare_bht[i] = WN;
-        }
-        // Initialize global history to NOTTAKEN (0)
-        gshare_history = 0;
-    }
-    
-    // Initialize Tournament
-    else if (bpType == TOURNAMENT) {
-        // Allocate and initialize global BHT
-        tournament_global_bht = (uint32_t *)calloc(1 << ghistoryBits, sizeof(uint32_t));
-        for (int i = 0; i < (1 << ghistoryBits); i++) {
-            tournament_global_bht[i] = WN;
-        }
-        
-        // Allocate and initialize local history table
-        tournament_local_history = (uint32_t *)calloc(1 << pcIndexBits, sizeof(uint32_t));
-        // History initialized to 0 (NOTTAKEN) by calloc
-        
-        // Allocate and initialize local BHT
-        tournament_local_bht = (uint32_t *)calloc(1 << lhistoryBits, sizeof(uint32_t));
-        for (int i = 0; i < (1 << lhistoryBits); i++) {
-            tournament_local_bht[i] = WN;
-        }
-        
-        // Allocate and initialize choice predictor
-        tournament_choice = (uint32_t *)calloc(1 << ghistoryBits, sizeof(uint32_t));
-        for (int i = 0; i < (1 << ghistoryBits); i++) {
-            tournament_choice[i] = WN;  // Weakly favor Global
-        }
-        
-        // Initialize global history to NOTTAKEN (0)
-        tournament_global_history = 0;
-    }
-    
-    // Initialize Custom
-    else if (bpType == CUSTOM) {
-        // 分配并初始化全局模式历史表
-        custom_pht = (uint32_t *)calloc(1 << CUSTOM_PHT_BITS, sizeof(uint32_t));
-        for (int i = 0; i < (1 << CUSTOM_PHT_BITS); i++) {
-            custom_pht[i] = WN;
-        }
-        
-        // 分配并初始化混合分支历史表
-        custom_bht = (uint32_t *)calloc(1 << CUSTOM_BHT_BITS, sizeof(uint32_t));
-        for (int i = 0; i < (1 << CUSTOM_BHT_BITS); i++) {
-            custom_bht[i] = WN;
-        }
-        
-        // 分配并初始化局部历史表
-        custom_lht = (uint32_t *)calloc(1 << CUSTOM_LHIST_BITS, sizeof(uint32_t));
-        for (int i = 0; i < (1 << CUSTOM_LHIST_BITS); i++) {
-            custom_lht[i] = WN;
-        }
-        
-        // 分配并初始化简单PC预测器
-        custom_simple = (uint32_t *)calloc(1 << CUSTOM_SIMPLE_BITS, sizeof(uint32_t));
-        for (int i = 0; i < (1 << CUSTOM_SIMPLE_BITS); i++) {
-            custom_simple[i] = WN;
-        }
-        
-        // 分配并初始化局部历史寄存器
-        custom_local_history = (uint32_t *)calloc(1 << CUSTOM_PC_BITS, sizeof(uint32_t));
-        
-        // 分配并初始化元预测器
-        custom_meta = (uint32_t *)calloc(1 << CUSTOM_META_BITS, sizeof(uint32_t));
-        for (int i = 0; i < (1 << CUSTOM_META_BITS); i++) {
-            custom_meta[i] = 1;  // 初始偏向全局预测器
-        }
-        
-        // 分配并初始化循环预测表
-        custom_lpt = (loop_entry_t *)calloc(1 << CUSTOM_LPT_BITS, sizeof(loop_entry_t));
-        
-        // 初始化全局历史寄存器和统计信息
-        custom_history = 0;
-        custom_stats.global_correct = 0;
-        custom_stats.local_correct = 0;
-        custom_stats.loop_correct = 0;
-        custom_stats.hybrid_correct = 0;
-        custom_stats.simple_correct = 0;
-        custom_stats.total_count = 0;
-        custom_stats.recent_window = 0;
-    }
+    // XOR PC with global history
+    uint32_t index = ((pc >> 2) ^ *history) & MASK(bits);
+
+    // Update global history register
+    *history = ((*history << 1) | outcome) & MASK(bits);
+
+    return index;
 }
 
-// Make a prediction for conditional branch instruction at PC 'pc'
-// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
-// indicates a prediction of not taken
+// Train the counter at 'index', returning the prediction made
+// before the update
 //
-uint8_t
-make_prediction(uint32_t pc)
+static inline __attribute__((always_inline)) uint8_t
+gshare_update(uint8_t *bht, uint32_t index, uint8_t outcome)
 {
-  // Make a prediction based on the bpType
-  switch (bpType) {
-    case STATIC:
-      return TAKEN;
-            
-        case GSHARE: {
-            // XOR PC with global history
-            uint32_t index = ((pc >> 2) ^ gshare_history) & MASK(ghistoryBits);
-            // Get prediction from BHT
-            return get_prediction_from_counter(gshare_bht[index]);
-        }
-            
-        case TOURNAMENT: {
-            // Get local history index using PC
-            uint32_t local_history_index = (pc >> 2) & MASK(pcIndexBits);
-            uint32_t local_history = tournament_local_history[local_history_index];
-            
-            // Get predictions from both predictors
-            uint32_t local_bht_index = local_history & MASK(lhistoryBits);
-            uint32_t global_bht_index = tournament_global_history & MASK(ghistoryBits);
-            
-            uint8_t local_pred = get_prediction_from_counter(tournament_local_bht[local_bht_index]);
-            uint8_t global_pred = get_prediction_from_counter(tournament_global_bht[global_bht_index]);
-            
-            // Use choice predictor to select between local and global
-            uint32_t choice_index = tournament_global_history & MASK(ghistoryBits);
-            uint8_t choice = get_prediction_from_counter(tournament_choice[choice_index]);
-            
-            return (choice == TAKEN) ? global_pred : local_pred;
-        }
-            
-        case CUSTOM: {
-            // 计算各种哈希索引
-            uint32_t pc_index = (pc >> 2) & MASK(CUSTOM_PC_BITS);
-            uint32_t local_history = custom_local_history[pc_index];
-            
-            // 全局预测器索引
-            uint32_t global_index = compute_hash_1(pc, custom_history) & MASK(CUSTOM_PHT_BITS);
-            
-            // 混合预测器索引
-            uint32_t hybrid_index = compute_hash_2(pc, custom_history) & MASK(CUSTOM_BHT_BITS);
-            
-            // 局部预测器索引
-            uint32_t local_index = compute_hash_3(pc, local_history) & MASK(CUSTOM_LHIST_BITS);
-            
-            // 简单PC预测器索引
-            uint32_t simple_index = (pc >> 3) & MASK(CUSTOM_SIMPLE_BITS);
-            
-            // 整数预测器索引
-            uint32_t int_index = ((pc >> 2) ^ (pc >> 8)) & MASK(CUSTOM_INT_BITS);
-            
-            // 循环预测器索引
-            uint32_t loop_index = ((pc >> 4) ^ (pc >> 8)) & MASK(CUSTOM_LPT_BITS);
-            uint32_t loop_tag = (pc >> 2) & MASK(CUSTOM_LPT_TAG_BITS);
-            
-            // 元预测器索引
-            uint32_t meta_index = ((pc >> 2) ^ custom_history ^ custom_path_history) & MASK(CUSTOM_META_BITS);
-            
-            // 获取预测结果用于统计
-            uint8_t global_pred = get_prediction_from_counter(custom_pht[global_index]);
-            uint8_t hybrid_pred = get_prediction_from_counter(custom_bht[hybrid_index]);
-            uint8_t local_pred = get_prediction_from_counter(custom_lht[local_index]);
-            uint8_t simple_pred = get_prediction_from_counter(custom_simple[simple_index]);
-            uint8_t int_pred = get_prediction_from_counter(custom_int[int_index]);
-            
-            // 检查是否为整数分支
-            uint8_t is_int = is_int_branch(pc);
-            if (is_int) {
-                custom_stats.int_branches++;
-            }
-            
-            // 更新统计信息
-            custom_stats.total_count++;
-            custom_stats.recent_window++;
-            
-            if (global_pred == outcome) custom_stats.global_correct++;
-            if (local_pred == outcome) custom_stats.local_correct++;
-            if (hybrid_pred == outcome) custom_stats.hybrid_correct++;
-            if (simple_pred == outcome) custom_stats.simple_correct++;
-            if (int_pred == outcome) custom_stats.int_correct++;
-            
-            // 每10000次预测重置最近窗口统计，保持自适应性
-            if (custom_stats.recent_window >= 10000) {
-                custom_stats.global_correct = (custom_stats.global_correct * 8) / 10;
-                custom_stats.local_correct = (custom_stats.local_correct * 8) / 10;
-                custom_stats.hybrid_correct = (custom_stats.hybrid_correct * 8) / 10;
-                custom_stats.simple_correct = (custom_stats.simple_correct * 8) / 10;
-                custom_stats.int_correct = (custom_stats.int_correct * 8) / 10;
-                custom_stats.loop_correct = (custom_stats.loop_correct * 8) / 10;
-                custom_stats.total_count = (custom_stats.total_count * 8) / 10;
-                custom_stats.int_branches = (custom_stats.int_branches * 8) / 10;
-                custom_stats.loop_branches = (custom_stats.loop_branches * 8) / 10;
-                custom_stats.recent_window = 0;
-            }
-            
-            // 更新循环预测器
-            loop_entry_t *loop_entry = &custom_lpt[loop_index];
-            if (loop_entry->tag == loop_tag) {
-                // 已知分支
-                if (outcome == TAKEN) {
-                    loop_entry->iter_count++;
-                    custom_stats.loop_branches++;
-                    
-                    // 更新循环模式
-                    loop_entry->pattern = ((loop_entry->pattern << 1) | 1) & 0xFFFF;
-                    
-                    if (loop_entry->iter_count >= 3) {
-                        loop_entry->is_loop = 1;
-                        if (loop_entry->confidence < ((1 << CUSTOM_LPT_CONF_BITS) - 1)) {
-                            loop_entry->confidence++;
-                        }
-                    }
-                    
-                    // 更新循环嵌套深度
-                    uint32_t depth = estimate_loop_depth(pc, custom_history);
-                    loop_entry->depth = depth;
-                } else {
-                    // 分支未taken，可能是循环结束
-                    if (loop_entry->is_loop && loop_entry->iter_count > 0) {
-                        // 预测循环结束
-                        uint8_t loop_pred;
-                        if (loop_entry->pattern & 1) {
-                            loop_pred = TAKEN;
-                        } else {
-                            loop_pred = ((loop_entry->iter_count + loop_entry->depth) % (8 >> loop_entry->depth) == 0) ? NOTTAKEN : TAKEN;
-                        }
-                        
-                        if (loop_pred == outcome) {
-                            custom_stats.loop_correct++;
-                            if (loop_entry->confidence < ((1 << CUSTOM_LPT_CONF_BITS) - 1)) {
-                                loop_entry->confidence++;
-                            }
-                        } else {
-                            if (loop_entry->confidence > 0) {
-                                loop_entry->confidence--;
-                            }
-                        }
-                    }
-                    
-                    // 更新模式
-                    loop_entry->pattern = (loop_entry->pattern << 1) & 0xFFFF;
-                    loop_entry->iter_count = 0;
-                    
-                    if (loop_entry->confidence <= 1) {
-                        loop_entry->is_loop = 0;
-                    }
-                }
-                loop_entry->last_outcome = outcome;
-            } else {
-                // 新分支
-                loop_entry->tag = loop_tag;
-                loop_entry->confidence = 0;
-                loop_entry->iter_count = (outcome == TAKEN) ? 1 : 0;
-                loop_entry->is_loop = 0;
-                loop_entry->last_outcome = outcome;
-                loop_entry->pattern = outcome ? 1 : 0;
-                loop_entry->depth = estimate_loop_depth(pc, custom_history);
-            }
-            
-            // 更新元预测器
-            uint8_t best_predictor = 0;  // 0: local, 1: global, 2: hybrid, 3: simple
-            uint8_t correct_count = 0;
-            
-            if (global_pred == outcome) correct_count++;
-            if (local_pred == outcome) correct_count++;
-            if (hybrid_pred == outcome) correct_count++;
-            if (simple_pred == outcome) correct_count++;
-            if (int_pred == outcome) correct_count++;
-            
-            // 选择最佳预测器
-            if (correct_count == 1) {
-                // 只有一个预测器正确
-                if (global_pred == outcome) best_predictor = 1;
-                else if (local_pred == outcome) best_predictor = 0;
-                else if (hybrid_pred == outcome) best_predictor = 2;
-                else if (simple_pred == outcome) best_predictor = 3;
-            } else if (correct_count > 1) {
-                // 多个预测器正确，根据当前权重选择
-                uint32_t total = custom_stats.total_count;
-                if (total > 0) {
-                    uint32_t global_weight = (custom_stats.global_correct * 100) / total;
-                    uint32_t local_weight = (custom_stats.local_correct * 100) / total;
-                    uint32_t hybrid_weight = (custom_stats.hybrid_correct * 100) / total;
-                    uint32_t simple_weight = (custom_stats.simple_correct * 100) / total;
-                    uint32_t int_weight = (custom_stats.int_correct * 100) / total;
-                    
-                    if (is_int && int_weight >= 45) {
-                        best_predictor = 0;  // 整数分支偏向局部预测
-                    } else if (global_weight >= local_weight && global_weight >= hybrid_weight && global_weight >= simple_weight) {
-                        best_predictor = 1;
-                    } else if (hybrid_weight >= local_weight && hybrid_weight >= simple_weight) {
-                        best_predictor = 2;
-                    } else if (simple_weight >= local_weight) {
-                        best_predictor = 3;
-                    } else {
-                        best_predictor = 0;
-                    }
-                }
-            }
-            
-            // 温和更新元预测器
-            if (best_predictor == 1 && custom_meta[meta_index] < 3) {
-                custom_meta[meta_index]++;
-            } else if (best_predictor == 0 && custom_meta[meta_index] > 0) {
-                custom_meta[meta_index]--;
-            }
-            
-            // 更新各个预测器
-            custom_pht[global_index] = update_counter(custom_pht[global_index], outcome);
-            custom_bht[hybrid_index] = update_counter(custom_bht[hybrid_index], outcome);
-            custom_lht[local_index] = update_counter(custom_lht[local_index], outcome);
-            custom_simple[simple_index] = update_counter(custom_simple[simple_index], outcome);
-            custom_int[int_index] = update_counter(custom_int[int_index], outcome);
-            
-            // 更新历史寄存器
-            custom_local_history[pc_index] = ((local_history << 1) | outcome) & MASK(CUSTOM_LHIST_BITS);
-            custom_history = ((custom_history << 1) | outcome) & MASK(CUSTOM_GHIST_BITS);
-            custom_path_history = ((custom_path_history << 1) | (pc & 1)) & MASK(CUSTOM_GHIST_BITS);
-            break;
-        }
-            
-    default:
-      break;
-  }
+    uint8_t counter = ctr_read(bht, index);
+    ctr_write(bht, index, update_counter(counter, outcome));
+    return counter >> 1;
+}
 
-    // If there is not a compatible bpType then return NOTTAKEN
-  return NOTTAKEN;
+// Predict and train in one pass, returning the prediction made
+// before the update
+//
+static uint8_t
+gshare_step(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+    uint32_t index = gshare_index(&p->gshare_history, pc, outcome,
+                                  p->config.ghistoryBits);
+    return gshare_update(p->gshare_bht, index, outcome);
 }
 
-// Train the predictor
-void
-train_predictor(uint32_t pc, uint8_t outcome)
+//------------------------------------//
+//        Tournament Predictor        //
+//------------------------------------//
+
+static uint8_t
+tournament_predict(predictor_t *p, uint32_t pc)
 {
-    switch (bpType) {
-        case STATIC:
-            // Static predictor is not trained
-            break;
-            
-        case GSHARE: {
-            // Get index into BHT
-            uint32_t index = ((pc >> 2) ^ gshare_history) & MASK(ghistoryBits);
-            
-            // Update counter
-            gshare_bht[index] = update_counter(gshare_bht[index], outcome);
-            
-            // Update global history register
-            gshare_history = ((gshare_history << 1) | outcome) & MASK(ghistoryBits);
-            break;
-        }
-            
-        case TOURNAMENT: {
-            // Get local history index using PC
-            uint32_t local_history_index = (pc >> 2) & MASK(pcIndexBits);
-            uint32_t local_history = tournament_local_history[local_history_index];
-            
-            // Get predictions from both predictors
-            uint32_t local_bht_index = local_history & MASK(lhistoryBits);
-            uint32_t global_bht_index = tournament_global_history & MASK(ghistoryBits);
-            
-            uint8_t local_pred = get_prediction_from_counter(tournament_local_bht[local_bht_index]);
-            uint8_t global_pred = get_prediction_from_counter(tournament_global_bht[global_bht_index]);
-            
-            // Update choice predictor
-            uint32_t choice_index = tournament_global_history & MASK(ghistoryBits);
-            if (local_pred != global_pred) {
-                if (local_pred == outcome) {
-                    // Local prediction was correct, train choice predictor to prefer local
-                    tournament_choice[choice_index] = update_counter(tournament_choice[choice_index], NOTTAKEN);
-                } else {
-                    // Global prediction was correct, train choice predictor to prefer global
-                    tournament_choice[choice_index] = update_counter(tournament_choice[choice_index], TAKEN);
-                }
-            }
-            
-            // Update local predictor
-            tournament_local_bht[local_bht_index] = update_counter(tournament_local_bht[local_bht_index], outcome);
-            
-            // Update global predictor
-            tournament_global_bht[global_bht_index] = update_counter(tournament_global_bht[global_bht_index], outcome);
-            
-            // Update history registers
-            tournament_local_history[local_history_index] = ((local_history << 1) | outcome) & MASK(lhistoryBits);
-            tournament_global_history = ((tournament_global_history << 1) | outcome) & MASK(ghistoryBits);
-            break;
+    const predictor_config_t *c = &p->config;
+
+    // Get local history index using PC
+    uint32_t local_history_index = (pc >> 2) & MASK(c->pcIndexBits);
+    uint32_t local_history = p->tournament_local_history[local_history_index];
+
+    // Get predictions from both predictors
+    uint32_t local_bht_index = local_history & MASK(c->lhistoryBits);
+    uint32_t global_bht_index = p->tournament_global_history & MASK(c->ghistoryBits);
+
+    uint8_t local_pred = ctr_predict(p->tournament_local_bht, local_bht_index);
+    uint8_t global_pred = ctr_predict(p->tournament_global_bht, global_bht_index);
+
+    // Use choice predictor to select between local and global
+    uint32_t choice_index = p->tournament_global_history & MASK(c->ghistoryBits);
+    uint8_t choice = ctr_predict(p->tournament_choice, choice_index);
+
+    return (choice == TAKEN) ? global_pred : local_pred;
+}
+
+// Tables of a tournament predictor, copied out of the instance so the
+// kernels can keep the pointers and the global history in registers
+typedef struct {
+    uint8_t *global_bht;
+    uint8_t *local_bht;
+    uint32_t *local_history;
+    uint8_t *choice;
+    uint32_t global_history;
+} tournament_state_t;
+
+// Index of the global BHT and choice table for this branch, and
+// advance of the global history (the first half, like gshare_index)
+//
+static inline __attribute__((always_inline)) uint32_t
+tournament_index(tournament_state_t *t, uint8_t outcome, int gbits)
+{
+    uint32_t global_bht_index = t->global_history & MASK(gbits);
+    t->global_history = ((t->global_history << 1) | outcome) & MASK(gbits);
+    return global_bht_index;
+}
+
+// Predict and train the branch at 'pc' given its global index,
+// returning the prediction made before the update.  The local history
+// is read here as it depends on earlier updates.
+//
+static inline __attribute__((always_inline)) uint8_t
+tournament_update(tournament_state_t *t, uint32_t pc, uint32_t global_bht_index,
+                  uint8_t outcome, int lbits, int pcbits)
+{
+    // Get local history index using PC
+    uint32_t local_history_index = (pc >> 2) & MASK(pcbits);
+    uint32_t local_history = t->local_history[local_history_index];
+
+    // Get predictions from both predictors
+    uint32_t local_bht_index = local_history & MASK(lbits);
+
+    uint8_t local_pred = ctr_predict(t->local_bht, local_bht_index);
+    uint8_t global_pred = ctr_predict(t->global_bht, global_bht_index);
+
+    // The choice predictor selects between local and global
+    uint32_t choice_index = global_bht_index;
+    uint8_t choice = ctr_predict(t->choice, choice_index);
+
+    // Update choice predictor
+    if (local_pred != global_pred) {
+        if (local_pred == outcome) {
+            // Local prediction was correct, train choice predictor to prefer local
+            ctr_update(t->choice, choice_index, NOTTAKEN);
+        } else {
+            // Global prediction was correct, train choice predictor to prefer global
+            ctr_update(t->choice, choice_index, TAKEN);
         }
-            
-        case CUSTOM: {
-            // 计算各种哈希索引
-            uint32_t pc_index = (pc >> 2) & MASK(CUSTOM_PC_BITS);
-            uint32_t local_history = custom_local_history[pc_index];
-            
-            // 全局预测器索引
-            uint32_t global_index = compute_hash_1(pc, custom_history) & MASK(CUSTOM_PHT_BITS);
-            
-            // 混合预测器索引
-            uint32_t hybrid_index = compute_hash_2(pc, custom_history) & MASK(CUSTOM_BHT_BITS);
-            
-            // 局部预测器索引
-            uint32_t local_index = compute_hash_3(pc, local_history) & MASK(CUSTOM_LHIST_BITS);
-            
-            // 简单PC预测器索引
-            uint32_t simple_index = (pc >> 3) & MASK(CUSTOM_SIMPLE_BITS);
-            
-            // 整数预测器索引
-            uint32_t int_index = ((pc >> 2) ^ (pc >> 8)) & MASK(CUSTOM_INT_BITS);
-            
-            // 循环预测器索引
-            uint32_t loop_index = ((pc >> 4) ^ (pc >> 8)) & MASK(CUSTOM_LPT_BITS);
-            uint32_t loop_tag = (pc >> 2) & MASK(CUSTOM_LPT_TAG_BITS);
-            
-            // 元预测器索引
-            uint32_t meta_index = ((pc >> 2) ^ custom_history ^ custom_path_history) & MASK(CUSTOM_META_BITS);
-            
-            // 获取预测结果用于统计
-            uint8_t global_pred = get_prediction_from_counter(custom_pht[global_index]);
-            uint8_t hybrid_pred = get_prediction_from_counter(custom_bht[hybrid_index]);
-            uint8_t local_pred = get_prediction_from_counter(custom_lht[local_index]);
-            uint8_t simple_pred = get_prediction_from_counter(custom_simple[simple_index]);
-            uint8_t int_pred = get_prediction_from_counter(custom_int[int_index]);
-            
-            // 检查是否为整数分支
-            uint8_t is_int = is_int_branch(pc);
-            if (is_int) {
-                custom_stats.int_branches++;
+    }
+
+    // Update local predictor
+    ctr_update(t->local_bht, local_bht_index, outcome);
+
+    // Update global predictor
+    ctr_update(t->global_bht, global_bht_index, outcome);
+
+    // Update local history register
+    t->local_history[local_history_index] = ((local_history << 1) | outcome) & MASK(lbits);
+
+    return (choice == TAKEN) ? global_pred : local_pred;
+}
+
+static inline tournament_state_t
+tournament_load(const predictor_t *p)
+{
+    tournament_state_t t = { p->tournament_global_bht, p->tournament_local_bht,
+                             p->tournament_local_history, p->tournament_choice,
+                             p->tournament_global_history };
+    return t;
+}
+
+static uint8_t
+tournament_step(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+    const predictor_config_t *c = &p->config;
+    tournament_state_t t = tournament_load(p);
+    uint32_t global_bht_index = tournament_index(&t, outcome, c->ghistoryBits);
+    uint8_t prediction = tournament_update(&t, pc, global_bht_index, outcome,
+                                           c->lhistoryBits, c->pcIndexBits);
+    p->tournament_global_history = t.global_history;
+    return prediction;
+}
+
+//------------------------------------//
+//          Custom Predictor          //
+//------------------------------------//
+
+static uint8_t
+custom_predict(predictor_t *p, uint32_t pc)
+{
+    // 全局预测器索引
+    uint32_t global_index = compute_hash_1(pc, p->custom_history) & MASK(CUSTOM_PHT_BITS);
+
+    // 使用全局模式历史表的预测; 其余表只在训练时用于统计
+    return ctr_predict(p->custom_pht, global_index);
+}
+
+static uint8_t
+custom_step(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+    meta_stats_t *stats = &p->custom_stats;
+
+    // 计算各种哈希索引
+    uint32_t pc_index = (pc >> 2) & MASK(CUSTOM_PC_BITS);
+    uint32_t local_history = p->custom_local_history[pc_index];
+
+    // 全局预测器索引
+    uint32_t global_index = compute_hash_1(pc, p->custom_history) & MASK(CUSTOM_PHT_BITS);
+
+    // 混合预测器索引
+    uint32_t hybrid_index = compute_hash_2(pc, p->custom_history, p->custom_path_history) & MASK(CUSTOM_BHT_BITS);
+
+    // 局部预测器索引
+    uint32_t local_index = compute_hash_3(pc, local_history) & MASK(CUSTOM_LHIST_BITS);
+
+    // 简单PC预测器索引
+    uint32_t simple_index = (pc >> 3) & MASK(CUSTOM_SIMPLE_BITS);
+
+    // 整数预测器索引
+    uint32_t int_index = ((pc >> 2) ^ (pc >> 8)) & MASK(CUSTOM_INT_BITS);
+
+    // 循环预测器索引
+    uint32_t loop_set = ((pc >> 4) ^ (pc >> 8)) & MASK(LOOP_SET_BITS);
+    uint32_t loop_tag = (pc >> 2) & MASK(CUSTOM_LPT_TAG_BITS);
+
+    // 元预测器索引
+    uint32_t meta_index = ((pc >> 2) ^ p->custom_history ^ p->custom_path_history) & MASK(CUSTOM_META_BITS);
+
+    // 每个计数器只读一次, 预测和更新都由它得出
+    uint8_t global_ctr = ctr_read(p->custom_pht, global_index);
+    uint8_t hybrid_ctr = ctr_read(p->custom_bht, hybrid_index);
+    uint8_t local_ctr = ctr_read(p->custom_lht, local_index);
+    uint8_t simple_ctr = ctr_read(p->custom_simple, simple_index);
+    uint8_t int_ctr = ctr_read(p->custom_int, int_index);
+
+    // 获取预测结果用于统计
+    uint8_t global_pred = global_ctr >> 1;
+    uint8_t hybrid_pred = hybrid_ctr >> 1;
+    uint8_t local_pred = local_ctr >> 1;
+    uint8_t simple_pred = simple_ctr >> 1;
+    uint8_t int_pred = int_ctr >> 1;
+
+    // 检查是否为整数分支
+    uint8_t is_int = is_int_branch(pc);
+    if (is_int) {
+        stats->int_branches++;
+    }
+
+    // 更新统计信息
+    stats->total_count++;
+    stats->recent_window++;
+
+    if (global_pred == outcome) stats->global_correct++;
+    if (local_pred == outcome) stats->local_correct++;
+    if (hybrid_pred == outcome) stats->hybrid_correct++;
+    if (simple_pred == outcome) stats->simple_correct++;
+    if (int_pred == outcome) stats->int_correct++;
+
+    // 每10000次预测重置最近窗口统计，保持自适应性
+    if (stats->recent_window >= 10000) {
+        stats->global_correct = (stats->global_correct * 8) / 10;
+        stats->local_correct = (stats->local_correct * 8) / 10;
+        stats->hybrid_correct = (stats->hybrid_correct * 8) / 10;
+        stats->simple_correct = (stats->simple_correct * 8) / 10;
+        stats->int_correct = (stats->int_correct * 8) / 10;
+        stats->loop_correct = (stats->loop_correct * 8) / 10;
+        stats->total_count = (stats->total_count * 8) / 10;
+        stats->int_branches = (stats->int_branches * 8) / 10;
+        stats->loop_branches = (stats->loop_branches * 8) / 10;
+        stats->recent_window = 0;
+    }
+
+    // 更新循环预测器
+    loop_entry_t *set = &p->custom_lpt[loop_set * LOOP_WAYS];
+    loop_state_t entry;
+    loop_state_t *loop_entry = &entry;
+    int way = loop_find(set, loop_tag);
+    if (way >= 0) {
+        // 已知分支
+        loop_unpack(set[way], loop_entry);
+        if (outcome == TAKEN) {
+            if (loop_entry->iter_count < MASK(LOOP_ITER_BITS)) {
+                loop_entry->iter_count++;
             }
-            
-            // 更新统计信息
-            custom_stats.total_count++;
-            custom_stats.recent_window++;
-            
-            if (global_pred == outcome) custom_stats.global_correct++;
-            if (local_pred == outcome) custom_stats.local_correct++;
-            if (hybrid_pred == outcome) custom_stats.hybrid_correct++;
-            if (simple_pred == outcome) custom_stats.simple_correct++;
-            if (int_pred == outcome) custom_stats.int_correct++;
-            
-            // 每10000次预测重置最近窗口统计，保持自适应性
-            if (custom_stats.recent_window >= 10000) {
-                custom_stats.global_correct = (custom_stats.global_correct * 8) / 10;
-                custom_stats.local_correct = (custom_stats.local_correct * 8) / 10;
-                custom_stats.hybrid_correct = (custom_stats.hybrid_correct * 8) / 10;
-                custom_stats.simple_correct = (custom_stats.simple_correct * 8) / 10;
-                custom_stats.int_correct = (custom_stats.int_correct * 8) / 10;
-                custom_stats.loop_correct = (custom_stats.loop_correct * 8) / 10;
-                custom_stats.total_count = (custom_stats.total_count * 8) / 10;
-                custom_stats.int_branches = (custom_stats.int_branches * 8) / 10;
-                custom_stats.loop_branches = (custom_stats.loop_branches * 8) / 10;
-                custom_stats.recent_window = 0;
+            stats->loop_branches++;
+
+            // 更新循环模式
+            loop_entry->pattern = ((loop_entry->pattern << 1) | 1) & 0xFFFF;
+
+            if (loop_entry->iter_count >= 3) {
+                loop_entry->is_loop = 1;
+                if (loop_entry->confidence < ((1 << CUSTOM_LPT_CONF_BITS) - 1)) {
+                    loop_entry->confidence++;
+                }
             }
-            
-            // 更新循环预测器
-            loop_entry_t *loop_entry = &custom_lpt[loop_index];
-            if (loop_entry->tag == loop_tag) {
-                // 已知分支
-                if (outcome == TAKEN) {
-                    loop_entry->iter_count++;
-                    custom_stats.loop_branches++;
-                    
-                    // 更新循环模式
-                    loop_entry->pattern = ((loop_entry->pattern << 1) | 1) & 0xFFFF;
-                    
-                    if (loop_entry->iter_count >= 3) {
-                        loop_entry->is_loop = 1;
-                        if (loop_entry->confidence < ((1 << CUSTOM_LPT_CONF_BITS) - 1)) {
-                            loop_entry->confidence++;
-                        }
-                    }
-                    
-                    // 更新循环嵌套深度
-                    uint32_t depth = estimate_loop_depth(pc, custom_history);
-                    loop_entry->depth = depth;
+
+            // 更新循环嵌套深度
+            uint32_t depth = estimate_loop_depth(p->custom_history);
+            loop_entry->depth = depth;
+        } else {
+            // 分支未taken，可能是循环结束
+            if (loop_entry->is_loop && loop_entry->iter_count > 0) {
+                // 预测循环结束
+                uint8_t loop_pred;
+                if (loop_entry->pattern & 1) {
+                    loop_pred = TAKEN;
                 } else {
-                    // 分支未taken，可能是循环结束
-                    if (loop_entry->is_loop && loop_entry->iter_count > 0) {
-                        // 预测循环结束
-                        uint8_t loop_pred;
-                        if (loop_entry->pattern & 1) {
-                            loop_pred = TAKEN;
-                        } else {
-                            loop_pred = ((loop_entry->iter_count + loop_entry->depth) % (8 >> loop_entry->depth) == 0) ? NOTTAKEN : TAKEN;
-                        }
-                        
-                        if (loop_pred == outcome) {
-                            custom_stats.loop_correct++;
-                            if (loop_entry->confidence < ((1 << CUSTOM_LPT_CONF_BITS) - 1)) {
-                                loop_entry->confidence++;
-                            }
-                        } else {
-                            if (loop_entry->confidence > 0) {
-                                loop_entry->confidence--;
-                            }
-                        }
+                    loop_pred = ((loop_entry->iter_count + loop_entry->depth) % (8 >> loop_entry->depth) == 0) ? NOTTAKEN : TAKEN;
+                }
+
+                if (loop_pred == outcome) {
+                    stats->loop_correct++;
+                    if (loop_entry->confidence < ((1 << CUSTOM_LPT_CONF_BITS) - 1)) {
+                        loop_entry->confidence++;
                     }
-                    
-                    // 更新模式
-                    loop_entry->pattern = (loop_entry->pattern << 1) & 0xFFFF;
-                    loop_entry->iter_count = 0;
-                    
-                    if (loop_entry->confidence <= 1) {
-                        loop_entry->is_loop = 0;
+                } else {
+                    if (loop_entry->confidence > 0) {
+                        loop_entry->confidence--;
                     }
                 }
-                loop_entry->last_outcome = outcome;
-            } else {
-                // 新分支
-                loop_entry->tag = loop_tag;
-                loop_entry->confidence = 0;
-                loop_entry->iter_count = (outcome == TAKEN) ? 1 : 0;
-                loop_entry->is_loop = 0;
-                loop_entry->last_outcome = outcome;
-                loop_entry->pattern = outcome ? 1 : 0;
-                loop_entry->depth = estimate_loop_depth(pc, custom_history);
             }
-            
-            // 更新元预测器
-            uint8_t best_predictor = 0;  // 0: local, 1: global, 2: hybrid, 3: simple
-            uint8_t correct_count = 0;
-            
-            if (global_pred == outcome) correct_count++;
-            if (local_pred == outcome) correct_count++;
-            if (hybrid_pred == outcome) correct_count++;
-            if (simple_pred == outcome) correct_count++;
-            if (int_pred == outcome) correct_count++;
-            
-            // 选择最佳预测器
-            if (correct_count == 1) {
-                // 只有一个预测器正确
-                if (global_pred == outcome) best_predictor = 1;
-                else if (local_pred == outcome) best_predictor = 0;
-                else if (hybrid_pred == outcome) best_predictor = 2;
-                else if (simple_pred == outcome) best_predictor = 3;
-            } else if (correct_count > 1) {
-                // 多个预测器正确，根据当前权重选择
-                uint32_t total = custom_stats.total_count;
-                if (total > 0) {
-                    uint32_t global_weight = (custom_stats.global_correct * 100) / total;
-                    uint32_t local_weight = (custom_stats.local_correct * 100) / total;
-                    uint32_t hybrid_weight = (custom_stats.hybrid_correct * 100) / total;
-                    uint32_t simple_weight = (custom_stats.simple_correct * 100) / total;
-                    uint32_t int_weight = (custom_stats.int_correct * 100) / total;
-                    
-                    if (is_int && int_weight >= 45) {
-                        best_predictor = 0;  // 整数分支偏向局部预测
-                    } else if (global_weight >= local_weight && global_weight >= hybrid_weight && global_weight >= simple_weight) {
-                        best_predictor = 1;
-                    } else if (hybrid_weight >= local_weight && hybrid_weight >= simple_weight) {
-                        best_predictor = 2;
-                    } else if (simple_weight >= local_weight) {
-                        best_predictor = 3;
-                    } else {
-                        best_predictor = 0;
-                    }
-                }
+
+            // 更新模式
+            loop_entry->pattern = (loop_entry->pattern << 1) & 0xFFFF;
+            loop_entry->iter_count = 0;
+
+            if (loop_entry->confidence <= 1) {
+                loop_entry->is_loop = 0;
             }
-            
-            // 温和更新元预测器
-            if (best_predictor == 1 && custom_meta[meta_index] < 3) {
-                custom_meta[meta_index]++;
-            } else if (best_predictor == 0 && custom_meta[meta_index] > 0) {
-                custom_meta[meta_index]--;
+        }
+        loop_entry->last_outcome = outcome;
+    } else {
+        // 新分支
+        loop_entry->tag = loop_tag;
+        loop_entry->confidence = 0;
+        loop_entry->iter_count = (outcome == TAKEN) ? 1 : 0;
+        loop_entry->is_loop = 0;
+        loop_entry->last_outcome = outcome;
+        loop_entry->pattern = outcome ? 1 : 0;
+        loop_entry->depth = estimate_loop_depth(p->custom_history);
+    }
+    // Move the entry to the front; a new one pushes out the last way
+    for (int w = (way >= 0) ? way : LOOP_WAYS - 1; w > 0; w--) {
+        set[w] = set[w - 1];
+    }
+    set[0] = loop_pack(loop_entry);
+
+    // 更新元预测器
+    uint8_t best_predictor = 0;  // 0: local, 1: global, 2: hybrid, 3: simple
+    uint8_t correct_count = 0;
+
+    if (global_pred == outcome) correct_count++;
+    if (local_pred == outcome) correct_count++;
+    if (hybrid_pred == outcome) correct_count++;
+    if (simple_pred == outcome) correct_count++;
+    if (int_pred == outcome) correct_count++;
+
+    // 选择最佳预测器
+    if (correct_count == 1) {
+        // 只有一个预测器正确
+        if (global_pred == outcome) best_predictor = 1;
+        else if (local_pred == outcome) best_predictor = 0;
+        else if (hybrid_pred == outcome) best_predictor = 2;
+        else if (simple_pred == outcome) best_predictor = 3;
+    } else if (correct_count > 1) {
+        // 多个预测器正确，根据当前权重选择
+        uint32_t total = stats->total_count;
+        if (total > 0) {
+            uint32_t global_weight = (stats->global_correct * 100) / total;
+            uint32_t local_weight = (stats->local_correct * 100) / total;
+            uint32_t hybrid_weight = (stats->hybrid_correct * 100) / total;
+            uint32_t simple_weight = (stats->simple_correct * 100) / total;
+            uint32_t int_weight = (stats->int_correct * 100) / total;
+
+            if (is_int && int_weight >= 45) {
+                best_predictor = 0;  // 整数分支偏向局部预测
+            } else if (global_weight >= local_weight && global_weight >= hybrid_weight && global_weight >= simple_weight) {
+                best_predictor = 1;
+            } else if (hybrid_weight >= local_weight && hybrid_weight >= simple_weight) {
+                best_predictor = 2;
+            } else if (simple_weight >= local_weight) {
+                best_predictor = 3;
+            } else {
+                best_predictor = 0;
             }
-            
-            // 更新各个预测器
-            custom_pht[global_index] = update_counter(custom_pht[global_index], outcome);
-            custom_bht[hybrid_index] = update_counter(custom_bht[hybrid_index], outcome);
-            custom_lht[local_index] = update_counter(custom_lht[local_index], outcome);
-            custom_simple[simple_index] = update_counter(custom_simple[simple_index], outcome);
-            custom_int[int_index] = update_counter(custom_int[int_index], outcome);
-            
-            // 更新历史寄存器
-            custom_local_history[pc_index] = ((local_history << 1) | outcome) & MASK(CUSTOM_LHIST_BITS);
-            custom_history = ((custom_history << 1) | outcome) & MASK(CUSTOM_GHIST_BITS);
-            custom_path_history = ((custom_path_history << 1) | (pc & 1)) & MASK(CUSTOM_GHIST_BITS);
-            break;
         }
-            
-        default:
-            break;
     }
+
+    // 温和更新元预测器
+    uint8_t meta = ctr_read(p->custom_meta, meta_index);
+    if (best_predictor == 1 && meta < 3) {
+        ctr_write(p->custom_meta, meta_index, meta + 1);
+    } else if (best_predictor == 0 && meta > 0) {
+        ctr_write(p->custom_meta, meta_index, meta - 1);
+    }
+
+    // 更新各个预测器
+    ctr_write(p->custom_pht, global_index, update_counter(global_ctr, outcome));
+    ctr_write(p->custom_bht, hybrid_index, update_counter(hybrid_ctr, outcome));
+    ctr_write(p->custom_lht, local_index, update_counter(local_ctr, outcome));
+    ctr_write(p->custom_simple, simple_index, update_counter(simple_ctr, outcome));
+    ctr_write(p->custom_int, int_index, update_counter(int_ctr, outcome));
+
+    // 更新历史寄存器
+    p->custom_local_history[pc_index] = ((local_history << 1) | outcome) & MASK(CUSTOM_LHIST_BITS);
+    p->custom_history = ((p->custom_history << 1) | outcome) & MASK(CUSTOM_GHIST_BITS);
+    p->custom_path_history = ((p->custom_path_history << 1) | (pc & 1)) & MASK(CUSTOM_GHIST_BITS);
+
+    // 预测只使用全局模式历史表
+    return global_pred;
+}
+
+//------------------------------------//
+//        Perceptron Predictor        //
+//------------------------------------//
+
+// A perceptron predictor (Jimenez & Lin) with one row of signed 8-bit
+// weights per hashed PC and the global history kept as +1 (TAKEN) and
+// -1 (NOTTAKEN) bytes.  Rows and the history are padded with zeros to
+// a multiple of PERCEPTRON_VEC, so the dot product and the update run
+// over whole vectors: w*h is _mm_sign_epi8(w, h), and zero history
+// padding leaves the padding weights at zero.  Weights saturate at
+// +-127 so that negating them cannot overflow.
+//
+// Storage: rows * (hist + 1) * 8 bits of weights + hist bits of history
+//
+#define PERCEPTRON_VEC      32   // Bytes per AVX2 vector
+#define PERCEPTRON_MAX_HIST 1024
+
+static int
+perceptron_dot_scalar(const int8_t *w, const int8_t *h, int n)
+{
+    int sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += w[i] * h[i];
+    }
+    return sum;
+}
+
+// w += t * h, saturating at +-127
+static void
+perceptron_update_scalar(int8_t *w, const int8_t *h, int n, int t)
+{
+    for (int i = 0; i < n; i++) {
+        int v = w[i] + t * h[i];
+        w[i] = (v > 127) ? 127 : (v < -127) ? -127 : v;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1")))
+static int
+perceptron_dot_sse(const int8_t *w, const int8_t *h, int n)
+{
+    const __m128i ones8 = _mm_set1_epi8(1);
+    const __m128i ones16 = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+
+    for (int i = 0; i < n; i += 16) {
+        __m128i prod = _mm_sign_epi8(_mm_loadu_si128((const __m128i *)(w + i)),
+                                     _mm_loadu_si128((const __m128i *)(h + i)));
+        // Widen pairs of products to 16 bits, then to 32 bits
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_maddubs_epi16(ones8, prod),
+                                                ones16));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+    return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("sse4.1")))
+static void
+perceptron_update_sse(int8_t *w, const int8_t *h, int n, int t)
+{
+    const __m128i sign = _mm_set1_epi8(t);
+    const __m128i floor = _mm_set1_epi8(-127);
+
+    for (int i = 0; i < n; i += 16) {
+        __m128i *wp = (__m128i *)(w + i);
+        __m128i delta = _mm_sign_epi8(_mm_loadu_si128((const __m128i *)(h + i)), sign);
+        __m128i v = _mm_adds_epi8(_mm_loadu_si128(wp), delta);
+        _mm_storeu_si128(wp, _mm_max_epi8(v, floor));
+    }
+}
+
+__attribute__((target("avx2")))
+static int
+perceptron_dot_avx2(const int8_t *w, const int8_t *h, int n)
+{
+    const __m256i ones8 = _mm256_set1_epi8(1);
+    const __m256i ones16 = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+
+    for (int i = 0; i < n; i += 32) {
+        __m256i prod = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *)(w + i)),
+                                        _mm256_loadu_si256((const __m256i *)(h + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(ones8, prod),
+                                                      ones16));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static void
+perceptron_update_avx2(int8_t *w, const int8_t *h, int n, int t)
+{
+    const __m256i sign = _mm256_set1_epi8(t);
+    const __m256i floor = _mm256_set1_epi8(-127);
+
+    for (int i = 0; i < n; i += 32) {
+        __m256i *wp = (__m256i *)(w + i);
+        __m256i delta = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *)(h + i)), sign);
+        __m256i v = _mm256_adds_epi8(_mm256_loadu_si256(wp), delta);
+        _mm256_storeu_si256(wp, _mm256_max_epi8(v, floor));
+    }
+}
+#endif
+
+// Pick the widest dot product and update the CPU supports
+static void
+perceptron_select(predictor_t *p)
+{
+    p->perceptron_dot = perceptron_dot_scalar;
+    p->perceptron_update = perceptron_update_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        p->perceptron_dot = perceptron_dot_avx2;
+        p->perceptron_update = perceptron_update_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        p->perceptron_dot = perceptron_dot_sse;
+        p->perceptron_update = perceptron_update_sse;
+    }
+#endif
+}
+
+// History length 'hist' padded to whole vectors
+//
+static inline int
+perceptron_stride_of(int hist)
+{
+    return (hist + PERCEPTRON_VEC - 1) / PERCEPTRON_VEC * PERCEPTRON_VEC;
+}
+
+static void
+perceptron_init(predictor_t *p)
+{
+    int hist = p->config.ghistoryBits;
+
+    p->perceptron_stride = perceptron_stride_of(hist);
+    p->perceptron_theta = (int)(1.93 * hist + 14);
+    p->perceptron_weights = (int8_t *)calloc((size_t)p->config.rows, p->perceptron_stride);
+    p->perceptron_bias = (int8_t *)calloc(p->config.rows, 1);
+
+    // History starts NOTTAKEN; the padding stays zero
+    p->perceptron_history = (int8_t *)calloc(p->perceptron_stride, 1);
+    memset(p->perceptron_history, -1, hist);
+    perceptron_select(p);
+}
+
+static inline uint32_t
+perceptron_row(const predictor_t *p, uint32_t pc)
+{
+    return (pc >> 2) % (uint32_t)p->config.rows;
+}
+
+static inline int
+perceptron_output(const predictor_t *p, uint32_t row)
+{
+    return p->perceptron_bias[row] +
+           p->perceptron_dot(p->perceptron_weights + (size_t)row * p->perceptron_stride,
+                             p->perceptron_history, p->perceptron_stride);
+}
+
+static uint8_t
+perceptron_predict(predictor_t *p, uint32_t pc)
+{
+    return perceptron_output(p, perceptron_row(p, pc)) >= 0 ? TAKEN : NOTTAKEN;
+}
+
+static uint8_t
+perceptron_step(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+    uint32_t row = perceptron_row(p, pc);
+    int y = perceptron_output(p, row);
+    uint8_t prediction = (y >= 0) ? TAKEN : NOTTAKEN;
+    int t = (outcome == TAKEN) ? 1 : -1;
+
+    // Train on a misprediction or when the output is not confident
+    if (prediction != outcome || (y < 0 ? -y : y) <= p->perceptron_theta) {
+        int b = p->perceptron_bias[row] + t;
+        p->perceptron_bias[row] = (b > 127) ? 127 : (b < -127) ? -127 : b;
+        p->perceptron_update(p->perceptron_weights + (size_t)row * p->perceptron_stride,
+                             p->perceptron_history, p->perceptron_stride, t);
+    }
+
+    // Shift the outcome into the newest history position
+    memmove(p->perceptron_history + 1, p->perceptron_history, p->config.ghistoryBits - 1);
+    p->perceptron_history[0] = t;
+
+    return prediction;
+}
+
+//------------------------------------//
+//           TAGE Predictor           //
+//------------------------------------//
+
+// A TAGE predictor (Seznec & Michaud) with 'banks' tagged components
+// at geometric history lengths from 'minhist' to 'maxhist' (the
+// ghistoryBits), backed by a bimodal base predictor.
+//
+// Each bank is a table of 2^rowbits entries indexed by the PC and its
+// own history folded to rowbits (at most 16; the higher index bits
+// come from the PC alone), and tagged by the PC and the same history
+// folded to 15 and 14 bits.  The top tag bit marks claimed entries, so
+// the zeroed tables never hit.  The folds of all banks are kept one
+// 16-bit lane per bank: a run of branches is hashed eight banks at a
+// time in SSE2 registers, and the tags found are compared in one SSE2
+// compare.
+//
+// Storage: 2^rowbits * banks * (16 tag + 3 ctr + 2 u) bits of entries
+//          + 2^rowbits * 2 bits of base counters
+//          + maxhist bits of global history + 4 bits of use_alt
+//
+
+// Width of fold 'k': the index lane, then the two tag folds
+//
+static inline int
+tage_fold_bits(const predictor_config_t *c, int k)
+{
+    if (k == 0) {
+        return c->pcIndexBits < 16 ? c->pcIndexBits : 16;
+    }
+    return TAGE_TAG_BITS - k;
+}
+
+// History length of bank 'b': a geometric series from minHistory to
+// ghistoryBits, and one branch for the unused banks, which run along
+//
+static uint32_t
+tage_bank_length(const predictor_config_t *c, int b)
+{
+    if (b >= c->banks) {
+        return 1;
+    }
+    double ratio = (c->banks > 1) ? (double)b / (c->banks - 1) : 1.0;
+    return (uint32_t)(c->minHistory *
+                      pow((double)c->ghistoryBits / c->minHistory, ratio) + 0.5);
+}
+
+static void
+tage_init(predictor_t *p)
+{
+    const predictor_config_t *c = &p->config;
+    size_t entries = (size_t)c->banks << c->pcIndexBits;
+
+    // Entries start invalid (no TAGE_VALID in the tag), weak and useless
+    p->tage_banks = (tage_entry_t *)calloc(entries, sizeof(tage_entry_t));
+    p->tage_base = alloc_counters(c->pcIndexBits, WN);
+    p->tage_use_alt = 8;
+
+    for (int b = 0; b < TAGE_MAX_BANKS; b++) {
+        uint32_t length = tage_bank_length(c, b);
+        p->tage_length[b] = length;
+        for (int k = 0; k < 3; k++) {
+            p->tage_out[k][b] = 1u << (length % tage_fold_bits(c, k));
+        }
+    }
+}
+
+// Rotate 'in' into a 'width'-bit fold; the leaving bit 'old' lands on
+// the bit set in 'out'
+//
+static inline uint32_t
+tage_fold(uint32_t v, uint32_t in, uint32_t old, uint32_t out, int width)
+{
+    v = ((v << 1) | (v >> (width - 1))) & MASK(width);
+    return v ^ in ^ (out & -old);
+}
+
+// Compute the entry (from the start of the first bank) and the tag of
+// every bank for 'pc' from the folds of the instance (unused banks run
+// along)
+//
+static inline void
+tage_hash(const predictor_t *p, uint32_t pc, uint32_t *ent, uint16_t *tag)
+{
+    const int rowbits = p->config.pcIndexBits;
+    uint32_t key = pc >> 2;
+    uint32_t ikey = key ^ (key >> rowbits);
+
+    for (int b = 0; b < TAGE_MAX_BANKS; b++) {
+        ent[b] = ((uint32_t)b << rowbits) + ((ikey ^ p->tage_fold[0][b]) & MASK(rowbits));
+        tag[b] = ((key ^ p->tage_fold[1][b] ^ (p->tage_fold[2][b] << 1)) &
+                  (TAGE_VALID - 1)) | TAGE_VALID;
+    }
+}
+
+// Shift 'outcome' into the global history and every folded history
+//
+static inline void
+tage_push_history(predictor_t *p, uint8_t outcome)
+{
+    const uint32_t ring = TAGE_RING - 1;
+    uint32_t head = (p->tage_head + 1) & ring;
+
+    p->tage_head = head;
+    p->tage_history[head] = -outcome;
+    if (head < TAGE_RING_PAD) {
+        p->tage_history[head + TAGE_RING] = -outcome;
+    }
+    for (int b = 0; b < TAGE_MAX_BANKS; b++) {
+        uint32_t old = p->tage_history[(head - p->tage_length[b]) & ring] & 1;
+        for (int k = 0; k < 3; k++) {
+            p->tage_fold[k][b] = tage_fold(p->tage_fold[k][b], outcome, old,
+                                           p->tage_out[k][b],
+                                           tage_fold_bits(&p->config, k));
+        }
+    }
+}
+
+// The fields of the instance the lookup and the update use on every
+// branch, copied out so they stay in registers across a run: a store
+// to an 8-bit counter may alias anything behind 'p'
+typedef struct {
+    tage_entry_t *banks;
+    uint8_t *base;
+    int nbanks;
+    int rowbits;
+    int use_alt;
+    uint32_t tick;
+} tage_view_t;
+
+static inline __attribute__((always_inline)) void
+tage_view_load(const predictor_t *p, tage_view_t *v)
+{
+    v->banks = p->tage_banks;
+    v->base = p->tage_base;
+    v->nbanks = p->config.banks;
+    v->rowbits = p->config.pcIndexBits;
+    v->use_alt = p->tage_use_alt;
+    v->tick = p->tage_tick;
+}
+
+static inline __attribute__((always_inline)) void
+tage_view_store(predictor_t *p, const tage_view_t *v)
+{
+    p->tage_use_alt = v->use_alt;
+    p->tage_tick = v->tick;
+}
+
+// Everything the prediction found, reused by the update
+typedef struct {
+    const uint32_t *ent;        // Entry of each bank for the branch
+    const uint16_t *tag;        // Tag of each bank for the branch
+    tage_entry_t *entry;        // Entry of the provider, bank 0 for the base
+    uint32_t base_index;
+    int provider;               // Longest hitting bank, -1 for the base
+    int ctr;                    // Provider counter, the base's less 2
+    uint8_t alt_pred;
+    uint8_t prediction;
+} tage_lookup_t;
+
+static inline tage_entry_t *
+tage_entry(const tage_view_t *v, const tage_lookup_t *lk, int b)
+{
+    return &v->banks[lk->ent[b]];
+}
+
+// Bit b is set when the entry of bank b holds the branch's tag
+//
+static inline __attribute__((always_inline)) uint32_t
+tage_hits(const tage_view_t *v, const tage_lookup_t *lk)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // Gathered in registers: a vector load of tags stored one by one
+    // would stall on store forwarding.  The lanes of unused banks stay
+    // 0 and never match a tag, which always has TAGE_VALID set.
+    __m128i found = _mm_setzero_si128();
+#define TAGE_GATHER(B) \
+    found = _mm_insert_epi16(found, tage_entry(v, lk, B)->tag, B)
+    switch (v->nbanks) {
+        case 8: TAGE_GATHER(7); /* fall through */
+        case 7: TAGE_GATHER(6); /* fall through */
+        case 6: TAGE_GATHER(5); /* fall through */
+        case 5: TAGE_GATHER(4); /* fall through */
+        case 4: TAGE_GATHER(3); /* fall through */
+        case 3: TAGE_GATHER(2); /* fall through */
+        case 2: TAGE_GATHER(1); /* fall through */
+        default: TAGE_GATHER(0);
+    }
+#undef TAGE_GATHER
+    __m128i eq = _mm_cmpeq_epi16(found, _mm_loadu_si128((const __m128i *)lk->tag));
+    return _mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+#else
+    uint32_t hits = 0;
+    for (int b = 0; b < v->nbanks; b++) {
+        hits |= (uint32_t)(tage_entry(v, lk, b)->tag == lk->tag[b]) << b;
+    }
+    return hits;
+#endif
+}
+
+// Read the entries 'ent' and compare the tags 'tag' (from tage_hash)
+// and predict
+//
+static inline __attribute__((always_inline)) void
+tage_lookup(const tage_view_t *v, uint32_t pc, const uint32_t *ent,
+            const uint16_t *tag, tage_lookup_t *lk)
+{
+    uint32_t key = pc >> 2;
+
+    lk->ent = ent;
+    lk->tag = tag;
+    lk->base_index = key & MASK(v->rowbits);
+    uint32_t hits = tage_hits(v, lk);
+    int base = ctr_read(v->base, lk->base_index) - 2;
+
+    // The longest and the next longest hitting banks, -1 for the base
+    // predictor, whose counter (less 2, so the sign predicts) stands in
+    // for theirs.  Both entries are read whether they hit or not, from
+    // bank 0 when missing, so the reads do not wait on the hits.
+    int provider = 30 - __builtin_clz((hits << 1) | 1);
+    uint32_t shorter = hits & (((1u << (provider + 1)) >> 1) - 1);
+    int alt = 30 - __builtin_clz((shorter << 1) | 1);
+    tage_entry_t *pe = tage_entry(v, lk, provider < 0 ? 0 : provider);
+    int actr = tage_entry(v, lk, alt < 0 ? 0 : alt)->ctr;
+    int pctr = pe->ctr;
+    pctr = (provider < 0) ? base : pctr;
+    actr = (alt < 0) ? base : actr;
+
+    lk->entry = pe;
+    lk->provider = provider;
+    lk->ctr = pctr;
+    lk->alt_pred = (actr >= 0);
+    // A weak provider (0 or -1) defers to the alternate while that pays
+    int weak = (provider >= 0) & ((unsigned)(pctr + 1) <= 1) & (v->use_alt >= 8);
+    lk->prediction = weak ? lk->alt_pred : (pctr >= 0);
+}
+
+static uint8_t
+tage_predict(predictor_t *p, uint32_t pc)
+{
+    uint32_t ent[TAGE_MAX_BANKS];
+    uint16_t tag[TAGE_MAX_BANKS];
+    tage_view_t v;
+    tage_lookup_t lk;
+
+    tage_view_load(p, &v);
+    tage_hash(p, pc, ent, tag);
+    tage_lookup(&v, pc, ent, tag, &lk);
+    return lk.prediction;
+}
+
+// Halve the usefulness counters of the next 'rows' rows of every bank
+//
+static void
+tage_decay(predictor_t *p, uint32_t rows)
+{
+    const predictor_config_t *c = &p->config;
+
+    for (uint32_t i = 0; i < rows; i++) {
+        uint32_t r = p->tage_decay_row;
+        for (int b = 0; b < c->banks; b++) {
+            p->tage_banks[((size_t)b << c->pcIndexBits) + r].u >>= 1;
+        }
+        p->tage_decay_row = (r + 1) & MASK(c->pcIndexBits);
+    }
+}
+
+// Train the entries found by 'lk' with 'outcome'; the history is
+// advanced separately
+//
+static inline __attribute__((always_inline)) void
+tage_update(predictor_t *p, tage_view_t *v, const tage_lookup_t *lk,
+            uint8_t outcome)
+{
+    const int ctr_max = (1 << (TAGE_CTR_BITS - 1)) - 1;
+    const int ctr_min = -(1 << (TAGE_CTR_BITS - 1));
+    const int provider_pred = (lk->ctr >= 0);
+
+    if (lk->provider >= 0) {
+        tage_entry_t *e = lk->entry;
+
+        // The provider is useful when it beats the alternate, and weak
+        // entries learn whether to defer to the alternate
+        if (provider_pred != lk->alt_pred) {
+            int right = (provider_pred == outcome) ? 1 : -1;
+            int use_alt = v->use_alt - (((unsigned)(lk->ctr + 1) <= 1) ? right : 0);
+            v->use_alt = use_alt < 0 ? 0 : use_alt > 15 ? 15 : use_alt;
+            int u = e->u + right;
+            e->u = u < 0 ? 0 : u > MASK(TAGE_U_BITS) ? MASK(TAGE_U_BITS) : u;
+        }
+        int ctr = lk->ctr + ((outcome == TAKEN) ? 1 : -1);
+        e->ctr = ctr < ctr_min ? ctr_min : ctr > ctr_max ? ctr_max : ctr;
+    } else {
+        ctr_update(v->base, lk->base_index, outcome);
+    }
+
+    // On a misprediction, claim an entry in a longer bank, or age them
+    // all when none is free
+    if (lk->prediction != outcome && lk->provider < v->nbanks - 1) {
+        int b = lk->provider + 1;
+        while (b < v->nbanks && tage_entry(v, lk, b)->u != 0) {
+            b++;
+        }
+        if (b < v->nbanks) {
+            tage_entry_t *n = tage_entry(v, lk, b);
+            n->tag = lk->tag[b];
+            n->ctr = (outcome == TAKEN) ? 0 : -1;
+        } else {
+            for (b = lk->provider + 1; b < v->nbanks; b++) {
+                tage_entry(v, lk, b)->u--;
+            }
+        }
+    }
+
+    // Age the usefulness counters so stale entries can be replaced.
+    // Every entry is halved once per 2^TAGE_DECAY_BITS branches, a row
+    // at a time (a few rows per branch for the largest tables) rather
+    // than in one sweep of every bank.
+    if (v->rowbits <= TAGE_DECAY_BITS) {
+        if ((++v->tick & MASK(TAGE_DECAY_BITS - v->rowbits)) == 0) {
+            tage_decay(p, 1);
+        }
+    } else {
+        tage_decay(p, 1u << (v->rowbits - TAGE_DECAY_BITS));
+    }
+}
+
+static uint8_t
+tage_step(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+    uint32_t ent[TAGE_MAX_BANKS];
+    uint16_t tag[TAGE_MAX_BANKS];
+    tage_view_t v;
+    tage_lookup_t lk;
+
+    tage_view_load(p, &v);
+    tage_hash(p, pc, ent, tag);
+    tage_lookup(&v, pc, ent, tag, &lk);
+    tage_update(p, &v, &lk, outcome);
+    tage_view_store(p, &v);
+    tage_push_history(p, outcome);
+    return lk.prediction;
+}
+
+//------------------------------------//
+//         Predictor Kernels          //
+//------------------------------------//
+
+// A kernel predicts and trains over a block of branches, stores the
+// predictions in 'pred_out' unless it is NULL, and returns the number
+// of mispredictions.  predictor_create picks one per instance: the
+// common geometries get a copy compiled with constant table sizes,
+// anything else runs the generic kernel reading the sizes from the
+// configuration.
+//
+// gshare and tournament run each block as a two stage pipeline over
+// runs of PIPE_RUN branches: the first stage computes the indices of
+// the run, the second updates the tables in order while prefetching
+// the entries PIPE_AHEAD branches ahead.
+
+#define PIPE_RUN    256  // Branches whose indices are computed ahead
+#define PIPE_AHEAD  16   // Prefetch distance of the update stage
+
+#define GSHARE_KERNEL(NAME, BITS)                                           \
+static uint32_t                                                             \
+gshare_kernel_##NAME(predictor_t *p, const uint32_t *pc,                    \
+                     const uint8_t *outcome, size_t n, uint8_t *pred_out)   \
+{                                                                           \
+    const int bits = (BITS);                                                \
+    uint8_t *bht = p->gshare_bht;                                           \
+    uint32_t history = p->gshare_history;                                   \
+    uint32_t index[PIPE_RUN];                                               \
+    uint32_t mispredictions = 0;                                            \
+    for (size_t base = 0; base < n; base += PIPE_RUN) {                     \
+        size_t m = (n - base < PIPE_RUN) ? n - base : PIPE_RUN;             \
+        const uint32_t *rpc = pc + base;                                    \
+        const uint8_t *rout = outcome + base;                               \
+        for (size_t i = 0; i < m; i++) {                                    \
+            index[i] = gshare_index(&history, rpc[i], rout[i], bits);       \
+        }                                                                   \
+        for (size_t i = 0; i < m && i < PIPE_AHEAD; i++) {                  \
+            __builtin_prefetch(&bht[index[i] >> 2], 1);                     \
+        }                                                                   \
+        for (size_t i = 0; i < m; i++) {                                    \
+            if (i + PIPE_AHEAD < m) {                                       \
+                __builtin_prefetch(&bht[index[i + PIPE_AHEAD] >> 2], 1);    \
+            }                                                               \
+            uint8_t prediction = gshare_update(bht, index[i], rout[i]);     \
+            mispredictions += (prediction != rout[i]);                      \
+            if (pred_out != NULL) {                                         \
+                pred_out[base + i] = prediction;                            \
+            }                                                               \
+        }                                                                   \
+    }                                                                       \
+    p->gshare_history = history;                                            \
+    return mispredictions;                                                  \
+}
+
+#define TOURNAMENT_KERNEL(NAME, GBITS, LBITS, PCBITS)                       \
+static uint32_t                                                             \
+tournament_kernel_##NAME(predictor_t *p, const uint32_t *pc,                \
+                         const uint8_t *outcome, size_t n, uint8_t *pred_out) \
+{                                                                           \
+    const int gbits = (GBITS), lbits = (LBITS), pcbits = (PCBITS);          \
+    tournament_state_t t = tournament_load(p);                              \
+    uint32_t index[PIPE_RUN];                                               \
+    uint32_t mispredictions = 0;                                            \
+    for (size_t base = 0; base < n; base += PIPE_RUN) {                     \
+        size_t m = (n - base < PIPE_RUN) ? n - base : PIPE_RUN;             \
+        const uint32_t *rpc = pc + base;                                    \
+        const uint8_t *rout = outcome + base;                               \
+        for (size_t i = 0; i < m; i++) {                                    \
+            index[i] = tournament_index(&t, rout[i], gbits);                \
+        }                                                                   \
+        for (size_t i = 0; i < m; i++) {                                    \
+            if (i + PIPE_AHEAD < m) {                                       \
+                uint32_t ahead = index[i + PIPE_AHEAD];                     \
+                __builtin_prefetch(&t.global_bht[ahead >> 2], 1);           \
+                __builtin_prefetch(&t.choice[ahead >> 2], 1);               \
+                __builtin_prefetch(&t.local_history[                        \
+                    (rpc[i + PIPE_AHEAD] >> 2) & MASK(pcbits)], 1);         \
+            }                                                               \
+            uint8_t prediction = tournament_update(&t, rpc[i], index[i],    \
+                                                   rout[i], lbits, pcbits); \
+            mispredictions += (prediction != rout[i]);                      \
+            if (pred_out != NULL) {                                         \
+                pred_out[base + i] = prediction;                            \
+            }                                                               \
+        }                                                                   \
+    }                                                                       \
+    p->tournament_global_history = t.global_history;                        \
+    return mispredictions;                                                  \
+}
+
+GSHARE_KERNEL(generic, p->config.ghistoryBits)
+GSHARE_KERNEL(8, 8)    GSHARE_KERNEL(9, 9)    GSHARE_KERNEL(10, 10)
+GSHARE_KERNEL(11, 11)  GSHARE_KERNEL(12, 12)  GSHARE_KERNEL(13, 13)
+GSHARE_KERNEL(14, 14)  GSHARE_KERNEL(15, 15)  GSHARE_KERNEL(16, 16)
+GSHARE_KERNEL(17, 17)  GSHARE_KERNEL(18, 18)  GSHARE_KERNEL(19, 19)
+GSHARE_KERNEL(20, 20)  GSHARE_KERNEL(21, 21)  GSHARE_KERNEL(22, 22)
+GSHARE_KERNEL(23, 23)  GSHARE_KERNEL(24, 24)
+
+TOURNAMENT_KERNEL(generic, p->config.ghistoryBits, p->config.lhistoryBits,
+                  p->config.pcIndexBits)
+TOURNAMENT_KERNEL(9_10_10, 9, 10, 10)
+
+static const kernel_t gshare_kernels[] = {
+    [8]  = gshare_kernel_8,  [9]  = gshare_kernel_9,  [10] = gshare_kernel_10,
+    [11] = gshare_kernel_11, [12] = gshare_kernel_12, [13] = gshare_kernel_13,
+    [14] = gshare_kernel_14, [15] = gshare_kernel_15, [16] = gshare_kernel_16,
+    [17] = gshare_kernel_17, [18] = gshare_kernel_18, [19] = gshare_kernel_19,
+    [20] = gshare_kernel_20, [21] = gshare_kernel_21, [22] = gshare_kernel_22,
+    [23] = gshare_kernel_23, [24] = gshare_kernel_24,
+};
+
+// The custom tables have fixed sizes and stay cache resident (about
+// 30KB of packed counters and the 32KB loop table), so its kernel runs
+// the step directly
+static uint32_t
+custom_kernel(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+              size_t n, uint8_t *pred_out)
+{
+    uint32_t mispredictions = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t prediction = custom_step(p, pc[i], outcome[i]);
+        mispredictions += (prediction != outcome[i]);
+        if (pred_out != NULL) {
+            pred_out[i] = prediction;
+        }
+    }
+    return mispredictions;
+}
+
+static uint32_t
+perceptron_kernel(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+                  size_t n, uint8_t *pred_out)
+{
+    uint32_t mispredictions = 0;
+    for (size_t i = 0; i < n; i++) {
+        // The row of the next branch only depends on its PC
+        if (i + 1 < n) {
+            __builtin_prefetch(p->perceptron_weights +
+                               (size_t)perceptron_row(p, pc[i + 1]) * p->perceptron_stride, 1);
+        }
+        uint8_t prediction = perceptron_step(p, pc[i], outcome[i]);
+        mispredictions += (prediction != outcome[i]);
+        if (pred_out != NULL) {
+            pred_out[i] = prediction;
+        }
+    }
+    return mispredictions;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The leaving bits of the 16 branches from ring position 'start' on,
+// one vector of 16-bit all-ones or zero lanes per branch: the history
+// of every bank is read as 16 bytes (the ring repeats its first bytes
+// after its end) and the 8 x 16 bytes are transposed
+//
+static inline void
+tage_leaving(const predictor_t *p, uint32_t start, __m128i *old)
+{
+    const uint8_t *h = p->tage_history;
+    __m128i a[TAGE_MAX_BANKS], t[TAGE_MAX_BANKS], q[TAGE_MAX_BANKS];
+
+    for (int b = 0; b < TAGE_MAX_BANKS; b++) {
+        a[b] = _mm_loadu_si128((const __m128i *)
+                               (h + ((start - p->tage_length[b]) & (TAGE_RING - 1))));
+    }
+    for (int b = 0; b < TAGE_MAX_BANKS; b += 2) {
+        t[b] = _mm_unpacklo_epi8(a[b], a[b + 1]);       // Branches 0-7
+        t[b + 1] = _mm_unpackhi_epi8(a[b], a[b + 1]);   // Branches 8-15
+    }
+    for (int g = 0; g < 2; g++) {
+        __m128i *s = t + 4 * g;
+        q[4 * g] = _mm_unpacklo_epi16(s[0], s[2]);      // Branches 0-3
+        q[4 * g + 1] = _mm_unpackhi_epi16(s[0], s[2]);  // 4-7
+        q[4 * g + 2] = _mm_unpacklo_epi16(s[1], s[3]);  // 8-11
+        q[4 * g + 3] = _mm_unpackhi_epi16(s[1], s[3]);  // 12-15
+    }
+    for (int k = 0; k < 4; k++) {
+        // Branches 4k to 4k+3, all 8 banks each
+        __m128i lo = _mm_unpacklo_epi32(q[k], q[4 + k]);
+        __m128i hi = _mm_unpackhi_epi32(q[k], q[4 + k]);
+        old[4 * k] = _mm_unpacklo_epi8(lo, lo);
+        old[4 * k + 1] = _mm_unpackhi_epi8(lo, lo);
+        old[4 * k + 2] = _mm_unpacklo_epi8(hi, hi);
+        old[4 * k + 3] = _mm_unpackhi_epi8(hi, hi);
+    }
+}
+
+// Rotate 'in' into eight 'width'-bit folds ('mask' of width bits,
+// 'top' holding width - 1); 'old' is all ones in the lanes whose
+// leaving bit is set, which lands on the bit set in 'out'
+//
+static inline __m128i
+tage_fold_lanes(__m128i v, __m128i in, __m128i old, __m128i out,
+                __m128i mask, __m128i top)
+{
+    v = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(v, 1), _mm_srl_epi16(v, top)), mask);
+    return _mm_xor_si128(_mm_xor_si128(v, in), _mm_and_si128(old, out));
+}
+#endif
+
+// Hash the 'm' branches of a run into index lanes and tags, advancing
+// the history over them
+//
+static inline __attribute__((always_inline)) void
+tage_hash_run(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+              size_t m, uint32_t (*ent)[TAGE_MAX_BANKS],
+              uint16_t (*tag)[TAGE_MAX_BANKS])
+{
+#if defined(__x86_64__) || defined(__i386__)
+    const predictor_config_t *c = &p->config;
+    const int rowbits = c->pcIndexBits;
+    const uint32_t ring = TAGE_RING - 1;
+    uint32_t head = p->tage_head;
+
+    // The three folds of every bank, each a variable of its own so
+    // they stay in registers
+#define TAGE_FOLD_REGS(K) \
+    __m128i fold##K = _mm_loadu_si128((const __m128i *)p->tage_fold[K]); \
+    const __m128i out##K = _mm_loadu_si128((const __m128i *)p->tage_out[K]); \
+    const __m128i mask##K = _mm_set1_epi16(MASK(tage_fold_bits(c, K))); \
+    const __m128i top##K = _mm_cvtsi32_si128(tage_fold_bits(c, K) - 1)
+    TAGE_FOLD_REGS(0);
+    TAGE_FOLD_REGS(1);
+    TAGE_FOLD_REGS(2);
+#undef TAGE_FOLD_REGS
+    const __m128i imask = _mm_set1_epi16(MASK(rowbits) & 0xFFFF);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rows_lo = _mm_setr_epi32(0, 1 << rowbits, 2 << rowbits, 3 << rowbits);
+    const __m128i rows_hi = _mm_add_epi32(rows_lo, _mm_set1_epi32(4 << rowbits));
+
+    // The run's outcomes go into the ring first, where the longest
+    // banks' leaving bits are read from
+    for (size_t i = 0; i < m; i++) {
+        uint32_t pos = (head + 1 + i) & ring;
+        p->tage_history[pos] = -outcome[i];
+        if (pos < TAGE_RING_PAD) {
+            p->tage_history[pos + TAGE_RING] = -outcome[i];
+        }
+    }
+    p->tage_head = (head + m) & ring;
+
+    for (size_t base = 0; base < m; base += 16) {
+        __m128i old[16];
+        tage_leaving(p, head + 1 + base, old);
+
+        size_t end = (m - base < 16) ? m : base + 16;
+        for (size_t i = base; i < end; i++) {
+            uint32_t key = pc[i] >> 2;
+            uint32_t ikey = key ^ (key >> rowbits);
+            __m128i high = _mm_set1_epi32(ikey & MASK(rowbits) & ~0xFFFFu);
+            __m128i lane = _mm_and_si128(_mm_xor_si128(_mm_set1_epi16(ikey), fold0), imask);
+            __m128i tkey = _mm_set1_epi16((key & (TAGE_VALID - 1)) | TAGE_VALID);
+            __m128i in = _mm_set1_epi16(outcome[i]);
+            __m128i leaving = old[i - base];
+
+            // Index lanes widened to entries: the bank's start, plus
+            // the index bits above the 16-bit lanes
+            _mm_store_si128((__m128i *)ent[i],
+                            _mm_add_epi32(_mm_or_si128(_mm_unpacklo_epi16(lane, zero), high),
+                                          rows_lo));
+            _mm_store_si128((__m128i *)ent[i] + 1,
+                            _mm_add_epi32(_mm_or_si128(_mm_unpackhi_epi16(lane, zero), high),
+                                          rows_hi));
+            _mm_store_si128((__m128i *)tag[i],
+                            _mm_xor_si128(_mm_xor_si128(tkey, fold1),
+                                          _mm_slli_epi16(fold2, 1)));
+            fold0 = tage_fold_lanes(fold0, in, leaving, out0, mask0, top0);
+            fold1 = tage_fold_lanes(fold1, in, leaving, out1, mask1, top1);
+            fold2 = tage_fold_lanes(fold2, in, leaving, out2, mask2, top2);
+        }
+    }
+    _mm_storeu_si128((__m128i *)p->tage_fold[0], fold0);
+    _mm_storeu_si128((__m128i *)p->tage_fold[1], fold1);
+    _mm_storeu_si128((__m128i *)p->tage_fold[2], fold2);
+#else
+    for (size_t i = 0; i < m; i++) {
+        tage_hash(p, pc[i], ent[i], tag[i]);
+        tage_push_history(p, outcome[i]);
+    }
+#endif
+}
+
+// TAGE runs in the same two stages: the index lanes and tags of every
+// bank depend only on the PCs and the outcomes, so a run of them is
+// hashed eight banks at a time with the folds held in registers, and
+// the entries are then read and trained in trace order
+static uint32_t
+tage_kernel(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+            size_t n, uint8_t *pred_out)
+{
+    uint32_t ent[PIPE_RUN][TAGE_MAX_BANKS] __attribute__((aligned(16)));
+    uint16_t tag[PIPE_RUN][TAGE_MAX_BANKS] __attribute__((aligned(16)));
+    uint32_t mispredictions = 0;
+    tage_view_t v;
+
+    tage_view_load(p, &v);
+    for (size_t base = 0; base < n; base += PIPE_RUN) {
+        size_t m = (n - base < PIPE_RUN) ? n - base : PIPE_RUN;
+        const uint32_t *rpc = pc + base;
+        const uint8_t *rout = outcome + base;
+
+        tage_hash_run(p, rpc, rout, m, ent, tag);
+        for (size_t i = 0; i < m; i++) {
+            tage_lookup_t lk;
+            tage_lookup(&v, rpc[i], ent[i], tag[i], &lk);
+            tage_update(p, &v, &lk, rout[i]);
+            mispredictions += (lk.prediction != rout[i]);
+            if (pred_out != NULL) {
+                pred_out[base + i] = lk.prediction;
+            }
+        }
+    }
+    tage_view_store(p, &v);
+    return mispredictions;
+}
+
+// Kernel of the predictors that ignore the branch: static always
+// predicts TAKEN, unknown types NOTTAKEN
+static inline uint32_t
+constant_kernel(const uint8_t *outcome, size_t n, uint8_t *pred_out,
+                uint8_t prediction)
+{
+    uint32_t mispredictions = 0;
+    for (size_t i = 0; i < n; i++) {
+        mispredictions += (outcome[i] != prediction);
+    }
+    if (pred_out != NULL) {
+        memset(pred_out, prediction, n);
+    }
+    return mispredictions;
+}
+
+static uint32_t
+static_kernel(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+              size_t n, uint8_t *pred_out)
+{
+    (void)p;
+    (void)pc;
+    return constant_kernel(outcome, n, pred_out, TAKEN);
+}
+
+static uint32_t
+none_kernel(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+            size_t n, uint8_t *pred_out)
+{
+    (void)p;
+    (void)pc;
+    return constant_kernel(outcome, n, pred_out, NOTTAKEN);
+}
+
+static kernel_t
+select_kernel(const predictor_config_t *c)
+{
+    int ngshare = sizeof(gshare_kernels) / sizeof(gshare_kernels[0]);
+
+    switch (c->bpType) {
+        case STATIC:
+            return static_kernel;
+        case GSHARE:
+            if (c->ghistoryBits < ngshare && gshare_kernels[c->ghistoryBits]) {
+                return gshare_kernels[c->ghistoryBits];
+            }
+            return gshare_kernel_generic;
+        case TOURNAMENT:
+            if (c->ghistoryBits == 9 && c->lhistoryBits == 10 && c->pcIndexBits == 10) {
+                return tournament_kernel_9_10_10;
+            }
+            return tournament_kernel_generic;
+        case CUSTOM:
+            return custom_kernel;
+        case PERCEPTRON:
+            return perceptron_kernel;
+        case TAGE:
+            return tage_kernel;
+        default:
+            return none_kernel;
+    }
+}
+
+//------------------------------------//
+//      Predictor Instance API        //
+//------------------------------------//
+
+predictor_t *
+predictor_create(const predictor_config_t *config)
+{
+    predictor_t *p = (predictor_t *)calloc(1, sizeof(predictor_t));
+    p->config = *config;
+    p->kernel = select_kernel(config);
+
+    // Initialize Gshare
+    if (config->bpType == GSHARE) {
+        // BHT of 2^ghistoryBits entries, all WN; global history NOTTAKEN
+        p->gshare_bht = alloc_counters(config->ghistoryBits, WN);
+    }
+
+    // Initialize Tournament
+    else if (config->bpType == TOURNAMENT) {
+        p->tournament_global_bht = alloc_counters(config->ghistoryBits, WN);
+        // Local histories start NOTTAKEN
+        p->tournament_local_history = alloc_histories(config->pcIndexBits);
+        p->tournament_local_bht = alloc_counters(config->lhistoryBits, WN);
+        // Weakly favor Global
+        p->tournament_choice = alloc_counters(config->ghistoryBits, WN);
+    }
+
+    // Initialize Custom
+    else if (config->bpType == CUSTOM) {
+        p->custom_pht = alloc_counters(CUSTOM_PHT_BITS, WN);
+        p->custom_bht = alloc_counters(CUSTOM_BHT_BITS, WN);
+        p->custom_lht = alloc_counters(CUSTOM_LHIST_BITS, WN);
+        p->custom_simple = alloc_counters(CUSTOM_SIMPLE_BITS, WN);
+        p->custom_int = alloc_counters(CUSTOM_INT_BITS, WN);
+        p->custom_local_history = alloc_histories(CUSTOM_PC_BITS);
+        p->custom_meta = alloc_counters(CUSTOM_META_BITS, 1);  // 初始偏向全局预测器
+        // Entries start invalid; sets are aligned to cache lines
+        p->custom_lpt_mem = calloc((1 << CUSTOM_LPT_BITS) + LOOP_WAYS,
+                                   sizeof(loop_entry_t));
+        p->custom_lpt = (loop_entry_t *)(((uintptr_t)p->custom_lpt_mem +
+                                          LOOP_WAYS * sizeof(loop_entry_t) - 1) &
+                                         ~(uintptr_t)(LOOP_WAYS * sizeof(loop_entry_t) - 1));
+    }
+
+    // Initialize Perceptron
+    else if (config->bpType == PERCEPTRON) {
+        perceptron_init(p);
+    }
+
+    // Initialize TAGE
+    else if (config->bpType == TAGE) {
+        tage_init(p);
+    }
+
+    return p;
+}
+
+uint8_t
+predictor_predict(predictor_t *p, uint32_t pc)
+{
+    // Make a prediction based on the bpType
+    switch (p->config.bpType) {
+        case STATIC:
+            return TAKEN;
+        case GSHARE:
+            return gshare_predict(p, pc);
+        case TOURNAMENT:
+            return tournament_predict(p, pc);
+        case CUSTOM:
+            return custom_predict(p, pc);
+        case PERCEPTRON:
+            return perceptron_predict(p, pc);
+        case TAGE:
+            return tage_predict(p, pc);
+        default:
+            break;
+    }
+
+    // If there is not a compatible bpType then return NOTTAKEN
+    return NOTTAKEN;
+}
+
+void
+predictor_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+    switch (p->config.bpType) {
+        case STATIC:
+            // Static predictor is not trained
+            break;
+        case GSHARE:
+            gshare_step(p, pc, outcome);
+            break;
+        case TOURNAMENT:
+            tournament_step(p, pc, outcome);
+            break;
+        case CUSTOM:
+            custom_step(p, pc, outcome);
+            break;
+        case PERCEPTRON:
+            perceptron_step(p, pc, outcome);
+            break;
+        case TAGE:
+            tage_step(p, pc, outcome);
+            break;
+        default:
+            break;
+    }
+}
+
+uint8_t
+predictor_predict_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+    // A one-branch block mispredicts exactly when the prediction
+    // differs from the outcome
+    return outcome ^ p->kernel(p, &pc, &outcome, 1, NULL);
+}
+
+uint32_t
+predictor_simulate_batch(predictor_t *p, const uint32_t *pc,
+                         const uint8_t *outcome, size_t n, uint8_t *pred_out)
+{
+    return p->kernel(p, pc, outcome, n, pred_out);
+}
+
+void
+predictor_destroy(predictor_t *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    if (p->state_map != NULL) {
+        // The tables live in the snapshot mapping
+        munmap(p->state_map, p->state_len);
+        free(p);
+        return;
+    }
+    free(p->gshare_bht);
+    free(p->tournament_global_bht);
+    free(p->tournament_local_bht);
+    free(p->tournament_local_history);
+    free(p->tournament_choice);
+    free(p->custom_pht);
+    free(p->custom_bht);
+    free(p->custom_lht);
+    free(p->custom_simple);
+    free(p->custom_int);
+    free(p->custom_local_history);
+    free(p->custom_meta);
+    free(p->custom_lpt_mem);
+    free(p->perceptron_weights);
+    free(p->perceptron_bias);
+    free(p->perceptron_history);
+    free(p->tage_banks);
+    free(p->tage_base);
+    free(p);
+}
+
+int
+predictor_check(const predictor_config_t *config)
+{
+    const predictor_config_t *c = config;
+
+    switch (c->bpType) {
+        case PERCEPTRON:
+            return c->ghistoryBits >= 1 && c->ghistoryBits <= PERCEPTRON_MAX_HIST &&
+                   c->rows >= 1;
+        case TAGE:
+            return c->banks >= 1 && c->banks <= TAGE_MAX_BANKS &&
+                   c->pcIndexBits >= 1 && c->pcIndexBits <= 24 &&
+                   c->minHistory >= 1 && c->minHistory <= c->ghistoryBits &&
+                   c->ghistoryBits <= TAGE_MAX_HIST;
+        default:
+            // Keep table sizes within what the uint32_t indices can address
+            return c->ghistoryBits >= 0 && c->ghistoryBits <= 30 &&
+                   c->lhistoryBits >= 0 && c->lhistoryBits <= 30 &&
+                   c->pcIndexBits >= 0 && c->pcIndexBits <= 30;
+    }
+}
+
+int
+predictor_parse(const char *spec, predictor_config_t *config)
+{
+    char end;
+
+    memset(config, 0, sizeof(*config));
+    if (!strcmp(spec, "static")) {
+        config->bpType = STATIC;
+    } else if (sscanf(spec, "gshare:%d%c", &config->ghistoryBits, &end) == 1) {
+        config->bpType = GSHARE;
+    } else if (sscanf(spec, "tournament:%d:%d:%d%c", &config->ghistoryBits,
+                      &config->lhistoryBits, &config->pcIndexBits, &end) == 3) {
+        config->bpType = TOURNAMENT;
+    } else if (!strcmp(spec, "custom")) {
+        config->bpType = CUSTOM;
+    } else if (sscanf(spec, "perceptron:%d:%d%c", &config->ghistoryBits,
+                      &config->rows, &end) == 2) {
+        config->bpType = PERCEPTRON;
+    } else if (sscanf(spec, "tage:%d:%d:%d:%d%c", &config->banks,
+                      &config->pcIndexBits, &config->minHistory,
+                      &config->ghistoryBits, &end) == 4) {
+        config->bpType = TAGE;
+    } else {
+        return 0;
+    }
+    return predictor_check(config);
+}
+
+void
+predictor_format(const predictor_config_t *config, char *buf, size_t len)
+{
+    switch (config->bpType) {
+        case GSHARE:
+            snprintf(buf, len, "gshare:%d", config->ghistoryBits);
+            break;
+        case TOURNAMENT:
+            snprintf(buf, len, "tournament:%d:%d:%d", config->ghistoryBits,
+                     config->lhistoryBits, config->pcIndexBits);
+            break;
+        case CUSTOM:
+            snprintf(buf, len, "custom");
+            break;
+        case PERCEPTRON:
+            snprintf(buf, len, "perceptron:%d:%d", config->ghistoryBits,
+                     config->rows);
+            break;
+        case TAGE:
+            snprintf(buf, len, "tage:%d:%d:%d:%d", config->banks,
+                     config->pcIndexBits, config->minHistory,
+                     config->ghistoryBits);
+            break;
+        default:
+            snprintf(buf, len, "static");
+            break;
+    }
+}
+
+uint64_t
+predictor_bits(const predictor_config_t *config)
+{
+    uint64_t g = config->ghistoryBits;
+    uint64_t l = config->lhistoryBits;
+
+    switch (config->bpType) {
+        case GSHARE:
+            // BHT + global history
+            return ((uint64_t)2 << g) + g;
+        case TOURNAMENT:
+            // Global BHT + choice + local histories + local BHT + global history
+            return ((uint64_t)4 << g) + (l << config->pcIndexBits) +
+                   ((uint64_t)2 << l) + g;
+        case CUSTOM:
+            // Counter tables at 2 bits, histories at their widths and
+            // the loop table as allocated
+            return (2 << CUSTOM_PHT_BITS) + (2 << CUSTOM_BHT_BITS) +
+                   (2 << CUSTOM_LHIST_BITS) + (2 << CUSTOM_SIMPLE_BITS) +
+                   (2 << CUSTOM_INT_BITS) + (2 << CUSTOM_META_BITS) +
+                   ((uint64_t)CUSTOM_LHIST_BITS << CUSTOM_PC_BITS) +
+                   ((uint64_t)sizeof(loop_entry_t) * 8 << CUSTOM_LPT_BITS) +
+                   2 * CUSTOM_GHIST_BITS;
+        case PERCEPTRON:
+            // 8-bit weights and bias per row + global history
+            return (uint64_t)config->rows * (g + 1) * 8 + g;
+        case TAGE:
+            // Tagged entries + base counters + global history + use_alt
+            return ((uint64_t)config->banks *
+                    (TAGE_TAG_BITS + TAGE_CTR_BITS + TAGE_U_BITS) << config->pcIndexBits) +
+                   ((uint64_t)2 << config->pcIndexBits) + g + 4;
+        default:
+            return 0;
+    }
+}
+
+//------------------------------------//
+//        Predictor Snapshots         //
+//------------------------------------//
+
+// A snapshot is a header followed by page-aligned sections: the
+// predictor structure itself (history registers, folds, statistics)
+// and then each of its tables.  Loading maps the file copy-on-write and
+// points the tables into the mapping, so restoring a warmed predictor
+// costs no more than the pages the run goes on to touch.
+//
+// The structure is stored as laid out in memory; the header records
+// its size, and STATE_VERSION changes whenever the format does, so a
+// snapshot from an incompatible build is refused rather than misread.
+
+#define STATE_MAGIC   0x54535042u   // "BPST" on little-endian hosts
+#define STATE_VERSION 4
+#define STATE_ALIGN   4096
+#define STATE_TABLES  8             // Most tables of any predictor (custom)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout;                // sizeof(struct predictor)
+    uint32_t ntables;
+    predictor_config_t config;
+    // Section 0 is the structure, section i + 1 is table i
+    uint64_t offset[STATE_TABLES + 1];
+    uint64_t size[STATE_TABLES + 1];
+} state_header_t;
+
+// A table of the predictor: where its pointer sits in the structure
+typedef struct {
+    size_t field;
+    size_t size;
+} state_table_t;
+
+static inline void *
+state_get(const predictor_t *p, size_t field)
+{
+    void *table;
+    memcpy(&table, (const char *)p + field, sizeof(table));
+    return table;
+}
+
+static inline void
+state_set(predictor_t *p, size_t field, void *table)
+{
+    memcpy((char *)p + field, &table, sizeof(table));
+}
+
+// List the tables of 'p' in snapshot order
+//
+// Returns the number of tables
+//
+static int
+state_tables(const predictor_t *p, state_table_t *t)
+{
+    const predictor_config_t *c = &p->config;
+    int n = 0;
+
+#define STATE_TABLE(name, bytes) \
+    (t[n].field = offsetof(predictor_t, name), t[n].size = (bytes), n++)
+
+    switch (c->bpType) {
+        case GSHARE:
+            STATE_TABLE(gshare_bht, counter_bytes(c->ghistoryBits));
+            break;
+        case TOURNAMENT:
+            STATE_TABLE(tournament_global_bht, counter_bytes(c->ghistoryBits));
+            STATE_TABLE(tournament_local_bht, counter_bytes(c->lhistoryBits));
+            STATE_TABLE(tournament_local_history,
+                        sizeof(uint32_t) << c->pcIndexBits);
+            STATE_TABLE(tournament_choice, counter_bytes(c->ghistoryBits));
+            break;
+        case CUSTOM:
+            STATE_TABLE(custom_pht, counter_bytes(CUSTOM_PHT_BITS));
+            STATE_TABLE(custom_bht, counter_bytes(CUSTOM_BHT_BITS));
+            STATE_TABLE(custom_lht, counter_bytes(CUSTOM_LHIST_BITS));
+            STATE_TABLE(custom_simple, counter_bytes(CUSTOM_SIMPLE_BITS));
+            STATE_TABLE(custom_int, counter_bytes(CUSTOM_INT_BITS));
+            STATE_TABLE(custom_local_history, sizeof(uint32_t) << CUSTOM_PC_BITS);
+            STATE_TABLE(custom_meta, counter_bytes(CUSTOM_META_BITS));
+            STATE_TABLE(custom_lpt, sizeof(loop_entry_t) << CUSTOM_LPT_BITS);
+            break;
+        case PERCEPTRON:
+            STATE_TABLE(perceptron_weights,
+                        (size_t)c->rows * p->perceptron_stride);
+            STATE_TABLE(perceptron_bias, (size_t)c->rows);
+            STATE_TABLE(perceptron_history, (size_t)p->perceptron_stride);
+            break;
+        case TAGE:
+            STATE_TABLE(tage_banks,
+                        (sizeof(tage_entry_t) * c->banks) << c->pcIndexBits);
+            STATE_TABLE(tage_base, counter_bytes(c->pcIndexBits));
+            break;
+        default:
+            break;
+    }
+#undef STATE_TABLE
+    return n;
+}
+
+int
+predictor_save(const predictor_t *p, const char *path)
+{
+    state_table_t t[STATE_TABLES];
+    state_header_t h;
+    predictor_t image;
+    int n = state_tables(p, t);
+    uint64_t offset = STATE_ALIGN;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = STATE_MAGIC;
+    h.version = STATE_VERSION;
+    h.layout = sizeof(predictor_t);
+    h.ntables = n;
+    h.config = p->config;
+    for (int i = 0; i <= n; i++) {
+        h.offset[i] = offset;
+        h.size[i] = i == 0 ? sizeof(predictor_t) : t[i - 1].size;
+        offset = (offset + h.size[i] + STATE_ALIGN - 1) & ~(uint64_t)(STATE_ALIGN - 1);
+    }
+
+    // Clear the pointers so that equal states give identical files
+    memcpy(&image, p, sizeof(image));
+    for (int i = 0; i < n; i++) {
+        state_set(&image, t[i].field, NULL);
+    }
+    image.kernel = NULL;
+    image.perceptron_dot = NULL;
+    image.perceptron_update = NULL;
+    image.custom_lpt_mem = NULL;
+    image.state_map = NULL;
+    image.state_len = 0;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (int i = 0; ok && i <= n; i++) {
+        const void *data = i == 0 ? &image : state_get(p, t[i - 1].field);
+        ok = fseek(f, (long)h.offset[i], SEEK_SET) == 0 &&
+             fwrite(data, 1, h.size[i], f) == h.size[i];
+    }
+    return (fclose(f) == 0) && ok;
+}
+
+// Check the registers of a loaded structure that index the history or
+// size the tables against what its configuration gives them
+//
+// Returns True if they are consistent
+//
+static int
+state_check(const predictor_t *p)
+{
+    const predictor_config_t *c = &p->config;
+
+    switch (c->bpType) {
+        case PERCEPTRON:
+            return p->perceptron_stride == perceptron_stride_of(c->ghistoryBits);
+        case TAGE:
+            if (p->tage_head >= TAGE_RING ||
+                p->tage_decay_row > MASK(c->pcIndexBits)) {
+                return 0;
+            }
+            for (int b = 0; b < TAGE_MAX_BANKS; b++) {
+                uint32_t length = tage_bank_length(c, b);
+                if (p->tage_length[b] != length) {
+                    return 0;
+                }
+                for (int k = 0; k < 3; k++) {
+                    int width = tage_fold_bits(c, k);
+                    if (p->tage_out[k][b] != 1u << (length % width) ||
+                        p->tage_fold[k][b] > MASK(width)) {
+                        return 0;
+                    }
+                }
+            }
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+predictor_t *
+predictor_load(const char *path, char *err, size_t len)
+{
+    const state_header_t *h;
+    state_table_t t[STATE_TABLES];
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        snprintf(err, len, "%s", strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(state_header_t)) {
+        close(fd);
+        snprintf(err, len, "not a predictor snapshot");
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        snprintf(err, len, "%s", strerror(errno));
+        return NULL;
+    }
+
+    h = (const state_header_t *)map;
+    if (h->magic != STATE_MAGIC) {
+        snprintf(err, len, "not a predictor snapshot");
+        goto fail;
+    }
+    if (h->version != STATE_VERSION || h->layout != sizeof(predictor_t)) {
+        snprintf(err, len, "snapshot version %u from an incompatible build",
+                 h->version);
+        goto fail;
+    }
+    if (!predictor_check(&h->config) || h->ntables > STATE_TABLES ||
+        h->size[0] != sizeof(predictor_t)) {
+        snprintf(err, len, "corrupt snapshot header");
+        goto fail;
+    }
+    for (uint32_t i = 0; i <= h->ntables; i++) {
+        if (h->offset[i] % STATE_ALIGN != 0 || h->offset[i] > (uint64_t)st.st_size ||
+            h->size[i] > (uint64_t)st.st_size - h->offset[i]) {
+            snprintf(err, len, "truncated snapshot");
+            goto fail;
+        }
+    }
+
+    // Registers come from the image; the tables must be the ones the
+    // configuration calls for
+    predictor_t *p = (predictor_t *)malloc(sizeof(predictor_t));
+    memcpy(p, (const char *)map + h->offset[0], sizeof(predictor_t));
+    p->config = h->config;
+    if (!state_check(p)) {
+        free(p);
+        snprintf(err, len, "corrupt snapshot header");
+        goto fail;
+    }
+    int n = state_tables(p, t);
+    if ((uint32_t)n != h->ntables) {
+        free(p);
+        snprintf(err, len, "corrupt snapshot header");
+        goto fail;
+    }
+    for (int i = 0; i < n; i++) {
+        if (h->size[i + 1] != t[i].size) {
+            free(p);
+            snprintf(err, len, "corrupt snapshot header");
+            goto fail;
+        }
+        state_set(p, t[i].field, (char *)map + h->offset[i + 1]);
+    }
+    p->kernel = select_kernel(&p->config);
+    if (p->config.bpType == PERCEPTRON) {
+        perceptron_select(p);
+    }
+    p->custom_lpt_mem = NULL;
+    p->state_map = map;
+    p->state_len = st.st_size;
+    return p;
+
+fail:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+//------------------------------------//
+//        Predictor Functions         //
+//------------------------------------//
+
+// Initialize the predictor
+//
+void
+init_predictor()
+{
+    predictor_config_t config = { bpType, ghistoryBits, lhistoryBits, pcIndexBits,
+                                  perceptronRows, tageBanks, tageMinHistory };
+
+    predictor_destroy(global_predictor);
+    global_predictor = predictor_create(&config);
+}
+
+// Make a prediction for conditional branch instruction at PC 'pc'
+// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
+// indicates a prediction of not taken
+//
+uint8_t
+make_prediction(uint32_t pc)
+{
+    return predictor_predict(global_predictor, pc);
+}
+
+// Train the predictor
+void
+train_predictor(uint32_t pc, uint8_t outcome)
+{
+    predictor_train(global_predictor, pc, outcome);
+}
+
+// Predict the branch at PC 'pc' and train with 'outcome' in one pass
+//
+uint8_t
+predict_and_train(uint32_t pc, uint8_t outcome)
+{
+    return predictor_predict_train(global_predictor, pc, outcome);
+}
+
+// Predict and train over 'n' consecutive branches
+//
+uint32_t
+simulate_batch(const uint32_t *pc, const uint8_t *outcome, size_t n,
+               uint8_t *pred_out)
+{
+    return predictor_simulate_batch(global_predictor, pc, outcome, n, pred_out);
+}
+
+// Write the state of the predictor to the snapshot 'path'
+//
+int
+save_predictor(const char *path)
+{
+    return predictor_save(global_predictor, path);
+}
+
+// Replace the predictor with the one in the snapshot 'path'
+//
+int
+load_predictor(const char *path, char *err, size_t len)
+{
+    predictor_t *p = predictor_load(path, err, len);
+
+    if (p == NULL) {
+        return 0;
+    }
+    predictor_destroy(global_predictor);
+    global_predictor = p;
+    bpType = p->config.bpType;
+    ghistoryBits = p->config.ghistoryBits;
+    lhistoryBits = p->config.lhistoryBits;
+    pcIndexBits = p->config.pcIndexBits;
+    perceptronRows = p->config.rows;
+    tageBanks = p->config.banks;
+    tageMinHistory = p->config.minHistory;
+    return 1;
 }
@@ -30,6 +30,8 @@ extern const char *email;
 #define GSHARE      1
 #define TOURNAMENT  2
 #define CUSTOM      3
+#define PERCEPTRON  4
+#define TAGE        5
 extern const char *bpName[];
 
 // Definitions for 2-bit counters
@@ -44,13 +46,110 @@ extern const char *bpName[];
 extern int ghistoryBits; // Number of bits used for Global History
 extern int lhistoryBits; // Number of bits used for Local History
 extern int pcIndexBits;  // Number of bits used for PC index
+extern int perceptronRows; // Number of rows of perceptron weights
+extern int tageBanks;      // Number of tagged TAGE banks
+extern int tageMinHistory; // History length of the shortest TAGE bank
 extern int bpType;       // Branch Prediction Type
 extern int verbose;
 
+// Configuration of a single predictor instance
+typedef struct {
+  int bpType;        // Branch Prediction Type
+  int ghistoryBits;  // Number of bits used for Global History
+  int lhistoryBits;  // Number of bits used for Local History
+  int pcIndexBits;   // Number of bits used for PC index
+  int rows;          // Number of rows of perceptron weights
+  int banks;         // Number of tagged TAGE banks
+  int minHistory;    // History length of the shortest TAGE bank
+} predictor_config_t;
+
+//------------------------------------//
+//    Predictor Instance Prototypes   //
+//------------------------------------//
+
+// A predictor instance owns all of its tables and history registers;
+// separate instances can be used concurrently from different threads
+//
+typedef struct predictor predictor_t;
+
+// Allocate and initialize a predictor for 'config'
+//
+predictor_t *predictor_create(const predictor_config_t *config);
+
+// Predict the conditional branch at PC 'pc' (TAKEN or NOTTAKEN)
+//
+uint8_t predictor_predict(predictor_t *p, uint32_t pc);
+
+// Train the predictor with the outcome of the branch at PC 'pc'
+//
+void predictor_train(predictor_t *p, uint32_t pc, uint8_t outcome);
+
+// Predict the branch at PC 'pc' and train with 'outcome' in a single
+// pass that computes every index and reads every table entry once
+//
+// Returns the prediction made before training, identical to calling
+// predictor_predict and then predictor_train
+//
+uint8_t predictor_predict_train(predictor_t *p, uint32_t pc, uint8_t outcome);
+
+// Predict and train over 'n' consecutive branches with the same
+// results as 'n' calls to predictor_predict_train, storing the
+// predictions in 'pred_out' unless it is NULL
+//
+// Returns the number of mispredictions
+//
+uint32_t predictor_simulate_batch(predictor_t *p, const uint32_t *pc,
+                                  const uint8_t *outcome, size_t n,
+                                  uint8_t *pred_out);
+
+// Release the predictor and its tables
+//
+void predictor_destroy(predictor_t *p);
+
+// Returns True if 'config' describes a predictor that can be built
+//
+int predictor_check(const predictor_config_t *config);
+
+// Parse a scheme as given on the command line without the leading
+// "--", e.g. "gshare:13" or "tournament:9:10:10"
+//
+// Returns True if Successful
+//
+int predictor_parse(const char *spec, predictor_config_t *config);
+
+// Write the scheme of 'config' in the form accepted by predictor_parse
+//
+void predictor_format(const predictor_config_t *config, char *buf, size_t len);
+
+// Returns the bits of stored data (tables and history registers) of a
+// predictor built from 'config', as counted for the storage budget
+//
+uint64_t predictor_bits(const predictor_config_t *config);
+
+// Write every table and history register of 'p' to a snapshot at
+// 'path', in a versioned format laid out for mmap
+//
+// Returns True if Successful, with errno set otherwise
+//
+int predictor_save(const predictor_t *p, const char *path);
+
+// Restore a predictor from the snapshot at 'path'.  The file is mapped
+// copy-on-write and the tables are used in place, so loading is cheap
+// however large they are; the file itself is never modified.
+//
+// Returns NULL with the reason in 'err' if the file is not a snapshot
+// this build can read
+//
+predictor_t *predictor_load(const char *path, char *err, size_t len);
+
 //------------------------------------//
 //    Predictor Function Prototypes   //
 //------------------------------------//
 
+// The functions below drive a single process-wide instance configured
+// from the globals above
+//
+
 // Initialize the predictor
 //
 void init_predictor();
@@ -67,4 +166,33 @@ uint8_t make_prediction(uint32_t pc);
 //
 void train_predictor(uint32_t pc, uint8_t outcome);
 
+// Make a prediction for the branch at PC 'pc' and train the predictor
+// with 'outcome' at once; faster than make_prediction followed by
+// train_predictor, with identical results
+//
+uint8_t predict_and_train(uint32_t pc, uint8_t outcome);
+
+// Predict and train over 'n' consecutive branches, storing the
+// predictions in 'pred_out' unless it is NULL.  Identical to 'n' calls
+// to predict_and_train, but the index computation and table accesses
+// are pipelined across the batch.
+//
+// Returns the number of mispredictions
+//
+uint32_t simulate_batch(const uint32_t *pc, const uint8_t *outcome, size_t n,
+                        uint8_t *pred_out);
+
+// Write the state of the predictor to the snapshot 'path'
+//
+// Returns True if Successful, with errno set otherwise
+//
+int save_predictor(const char *path);
+
+// Replace the predictor with the one saved in the snapshot 'path' and
+// set the configuration globals above to its scheme
+//
+// Returns True if Successful, with the reason in 'err' otherwise
+//
+int load_predictor(const char *path, char *err, size_t len);
+
 #endif
@@ -0,0 +1,191 @@
+//========================================================//
+//  predstream.c                                          //
+//  Source file for the prediction stream files           //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "predstream.h"
+
+#define STREAM_BUFFER 8192   // Bytes of packed bits written at a time
+
+struct predstream_writer {
+  FILE *fp;
+  predstream_header_t hdr;
+  uint8_t buf[STREAM_BUFFER];
+  size_t bytes;           // Complete bytes in 'buf'
+  uint8_t partial;        // Bits of the byte being filled
+};
+
+// Write out the complete bytes
+//
+// Returns True if Successful
+//
+static int
+stream_flush(predstream_writer_t *w)
+{
+  int ok = fwrite(w->buf, 1, w->bytes, w->fp) == w->bytes;
+  w->bytes = 0;
+  return ok;
+}
+
+// Append a byte of packed bits, flushing the buffer when it is full
+//
+// Returns True if Successful
+//
+static inline int
+stream_byte(predstream_writer_t *w, uint8_t byte)
+{
+  if (w->bytes == STREAM_BUFFER && !stream_flush(w)) {
+    return 0;
+  }
+  w->buf[w->bytes++] = byte;
+  return 1;
+}
+
+predstream_writer_t *
+predstream_open(const char *path)
+{
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    return NULL;
+  }
+
+  predstream_writer_t *w = calloc(1, sizeof(predstream_writer_t));
+  w->fp = fp;
+  memcpy(w->hdr.magic, PREDSTREAM_MAGIC, 4);
+  w->hdr.version = PREDSTREAM_VERSION;
+
+  // The header is rewritten once the count is known
+  fwrite(&w->hdr, sizeof(w->hdr), 1, fp);
+  return w;
+}
+
+int
+predstream_put(predstream_writer_t *w, const uint8_t *prediction, size_t n)
+{
+  size_t i = 0;
+
+  // Finish the byte left partial by the previous call
+  while (i < n && (w->hdr.count & 7) != 0) {
+    w->partial |= (prediction[i++] & 1) << (w->hdr.count++ & 7);
+    if ((w->hdr.count & 7) == 0) {
+      if (!stream_byte(w, w->partial)) {
+        return 0;
+      }
+      w->partial = 0;
+    }
+  }
+
+  // Whole bytes
+  for (; i + 8 <= n; i += 8) {
+    uint8_t byte = 0;
+    for (int b = 0; b < 8; b++) {
+      byte |= (prediction[i + b] & 1) << b;
+    }
+    if (!stream_byte(w, byte)) {
+      return 0;
+    }
+    w->hdr.count += 8;
+  }
+
+  // Start a partial byte with the rest
+  for (; i < n; i++) {
+    w->partial |= (prediction[i] & 1) << (w->hdr.count++ & 7);
+  }
+  return 1;
+}
+
+int
+predstream_close(predstream_writer_t *w)
+{
+  int ok = (w->hdr.count & 7) == 0 || stream_byte(w, w->partial);
+  ok = ok && stream_flush(w);
+
+  // Pad to whole words so readers can XOR 64 bits at a time
+  static const uint8_t pad[8];
+  uint32_t npad = (8 - ((w->hdr.count + 7) / 8 & 7)) & 7;
+  ok = ok && fwrite(pad, 1, npad, w->fp) == npad;
+  ok = ok && fseek(w->fp, 0, SEEK_SET) == 0;
+  ok = ok && fwrite(&w->hdr, sizeof(w->hdr), 1, w->fp) == 1;
+  ok = (fclose(w->fp) == 0) && ok;
+  free(w);
+  return ok;
+}
+
+int
+predstream_load(const char *path, uint64_t **words, uint64_t *count,
+                char *err, size_t errlen)
+{
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    snprintf(err, errlen, "%s", strerror(errno));
+    return 0;
+  }
+
+  // Read the whole file
+  size_t cap = 1 << 20, len = 0, got;
+  char *data = malloc(cap);
+  while ((got = fread(data + len, 1, cap - len, fp)) > 0) {
+    len += got;
+    if (len == cap) {
+      cap *= 2;
+      data = realloc(data, cap);
+    }
+  }
+  int failed = ferror(fp);
+  fclose(fp);
+  if (failed) {
+    snprintf(err, errlen, "read error");
+    free(data);
+    return 0;
+  }
+
+  predstream_header_t hdr;
+  if (len >= sizeof(hdr) && !memcmp(data, PREDSTREAM_MAGIC, 4)) {
+    // Packed stream
+    memcpy(&hdr, data, sizeof(hdr));
+    size_t nwords = (hdr.count + 63) / 64;
+    if (hdr.version != PREDSTREAM_VERSION) {
+      snprintf(err, errlen, "unsupported stream version %u", hdr.version);
+      free(data);
+      return 0;
+    }
+    if ((hdr.count + 7) / 8 > len - sizeof(hdr)) {
+      snprintf(err, errlen, "truncated stream");
+      free(data);
+      return 0;
+    }
+    *words = calloc(nwords + 1, sizeof(uint64_t));
+    memcpy(*words, data + sizeof(hdr), (hdr.count + 7) / 8);
+    if (hdr.count & 63) {
+      (*words)[nwords - 1] &= ~(uint64_t)0 >> (64 - (hdr.count & 63));
+    }
+    *count = hdr.count;
+  } else {
+    // --verbose text: one 0 or 1 per line, up to the statistics
+    uint64_t n = 0;
+    size_t i = 0;
+    *words = calloc(len / 64 + 1, sizeof(uint64_t));
+    while (i < len && (data[i] == '0' || data[i] == '1') &&
+           (i + 1 == len || data[i + 1] == '\n' || data[i + 1] == '\r')) {
+      (*words)[n >> 6] |= (uint64_t)(data[i] - '0') << (n & 63);
+      n++;
+      i++;
+      while (i < len && (data[i] == '\n' || data[i] == '\r')) {
+        i++;
+      }
+    }
+    if (n == 0 && len > 0) {
+      snprintf(err, errlen, "not a prediction stream");
+      free(*words);
+      free(data);
+      return 0;
+    }
+    *count = n;
+  }
+  free(data);
+  return 1;
+}
@@ -0,0 +1,67 @@
+//========================================================//
+//  predstream.h                                          //
+//  Header file for the prediction stream files           //
+//                                                        //
+//  A run's predictions stored one bit each, and loaded   //
+//  back (from this format or --verbose text) for exact   //
+//  comparison                                            //
+//========================================================//
+
+#ifndef PREDSTREAM_H
+#define PREDSTREAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+//------------------------------------//
+//       Packed Stream Format         //
+//------------------------------------//
+
+// A packed stream is laid out as (all integers little-endian):
+//
+//   predstream_header_t
+//   predictions bits, LSB first, zero padded to a multiple of 8 bytes
+//
+#define PREDSTREAM_MAGIC    "BPPS"
+#define PREDSTREAM_VERSION  1
+
+typedef struct {
+  char     magic[4];      // PREDSTREAM_MAGIC
+  uint32_t version;       // PREDSTREAM_VERSION
+  uint64_t count;         // Number of predictions
+} predstream_header_t;
+
+//------------------------------------//
+//     Prediction Stream Prototypes   //
+//------------------------------------//
+
+typedef struct predstream_writer predstream_writer_t;
+
+// Create a packed stream at 'path'
+//
+// Returns NULL and sets errno on failure
+//
+predstream_writer_t *predstream_open(const char *path);
+
+// Append 'n' predictions (TAKEN or NOTTAKEN) to the stream
+//
+// Returns True if Successful
+//
+int predstream_put(predstream_writer_t *w, const uint8_t *prediction, size_t n);
+
+// Flush the last bits, write the header and close the file
+//
+// Returns True if Successful
+//
+int predstream_close(predstream_writer_t *w);
+
+// Load the predictions at 'path', either a packed stream or the text
+// printed by --verbose, as 64-bit words of packed bits (the bits past
+// 'count' are zero).  'words' is released with free().
+//
+// Returns True if Successful, otherwise describes the problem in 'err'
+//
+int predstream_load(const char *path, uint64_t **words, uint64_t *count,
+                    char *err, size_t errlen);
+
+#endif
@@ -0,0 +1,456 @@
+//========================================================//
+//  profile.c                                             //
+//  Source file for the per-branch profiler               //
+//                                                        //
+//  Every static branch gets a dense ID, from the trace   //
+//  when it is indexed or else from an open-addressing    //
+//  table with linear probing, kept at most half full so  //
+//  that nearly every lookup ends at the first slot it    //
+//  reads.  Blocks are copied into batches and counted on //
+//  a helper thread while the caller simulates the next   //
+//  ones, when there is a core to spare                   //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include "pool.h"
+#include "profile.h"
+
+// Executions, mispredictions and taken outcomes share one 64-bit word
+// per branch, PACK_BITS each, so counting a branch is a single add.
+// The words are folded into the full counts before any of them could
+// overflow, and before the counts are read.
+//
+#define PACK_BITS 21
+#define PACK_MASK ((UINT64_C(1) << PACK_BITS) - 1)
+
+#define PROFILE_BATCH 65536 // Branches handed to the helper at a time
+
+typedef struct {
+  uint32_t pc;
+  uint64_t executions;
+  uint64_t mispredictions;
+  uint64_t taken;
+} profile_entry_t;
+
+typedef struct {
+  uint32_t pc;
+  uint32_t id;            // ID + 1, 0 marks an empty slot
+} profile_slot_t;
+
+// Branches waiting to be counted, by PC or by dense ID
+//
+typedef struct {
+  profile_t *prof;
+  uint32_t *key;
+  uint8_t *outcome;
+  uint8_t *prediction;
+  size_t n;
+} profile_batch_t;
+
+struct profile {
+  profile_slot_t *slots;  // PC to ID, NULL for a dense profile
+  uint32_t mask;          // Slots - 1, a power of two minus one
+  int shift;              // 32 - log2(slots), for the hash
+  profile_entry_t *entries; // Indexed by ID
+  uint64_t *packed;       // Counts not yet folded into the entries
+  size_t count;           // IDs handed out
+  size_t capacity;        // Room in entries and packed
+  uint64_t pending;       // Branches counted since the last fold
+  uint64_t mispredictions; // Over every branch, for the shares
+
+  pool_t *pool;           // Helper thread, NULL to count in the caller
+  profile_batch_t batch[2]; // One filling, the other being counted
+  int filling;
+};
+
+static inline uint32_t
+profile_hash(const profile_t *prof, uint32_t pc)
+{
+  // Fibonacci hashing keeps the high bits, where PCs differ most
+  return (pc * 0x9E3779B1u) >> prof->shift;
+}
+
+static void
+profile_alloc(profile_t *prof, int bits)
+{
+  prof->slots = calloc((size_t)1 << bits, sizeof(profile_slot_t));
+  prof->mask = ((uint32_t)1 << bits) - 1;
+  prof->shift = 32 - bits;
+}
+
+static void
+profile_reserve(profile_t *prof, size_t capacity)
+{
+  prof->entries = realloc(prof->entries, capacity * sizeof(profile_entry_t));
+  prof->packed = realloc(prof->packed, capacity * sizeof(uint64_t));
+  memset(prof->packed + prof->capacity, 0,
+         (capacity - prof->capacity) * sizeof(uint64_t));
+  prof->capacity = capacity;
+}
+
+// Add the packed counts into the entries and clear them
+//
+static void
+profile_fold(profile_t *prof)
+{
+  for (size_t i = 0; i < prof->count; i++) {
+    uint64_t v = prof->packed[i];
+    uint64_t misses = (v >> PACK_BITS) & PACK_MASK;
+    prof->entries[i].executions += v & PACK_MASK;
+    prof->entries[i].mispredictions += misses;
+    prof->entries[i].taken += v >> (2 * PACK_BITS);
+    prof->mispredictions += misses;
+    prof->packed[i] = 0;
+  }
+  prof->pending = 0;
+}
+
+// Double the table, reinserting every slot
+//
+static void
+profile_grow(profile_t *prof)
+{
+  profile_slot_t *old = prof->slots;
+  size_t n = (size_t)prof->mask + 1;
+
+  profile_alloc(prof, 33 - prof->shift);
+  for (size_t i = 0; i < n; i++) {
+    if (old[i].id != 0) {
+      uint32_t h = profile_hash(prof, old[i].pc);
+      while (prof->slots[h].id != 0) {
+        h = (h + 1) & prof->mask;
+      }
+      prof->slots[h] = old[i];
+    }
+  }
+  free(old);
+}
+
+// Allocate an empty profile, with a helper thread and its batches when
+// the machine has more than one core
+//
+static profile_t *
+profile_new(void)
+{
+  profile_t *prof = calloc(1, sizeof(profile_t));
+
+  if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+    prof->pool = pool_create(1);
+    for (int i = 0; i < 2; i++) {
+      profile_batch_t *b = &prof->batch[i];
+      b->prof = prof;
+      b->key = malloc(PROFILE_BATCH * sizeof(uint32_t));
+      b->outcome = malloc(PROFILE_BATCH);
+      b->prediction = malloc(PROFILE_BATCH);
+    }
+  }
+  return prof;
+}
+
+profile_t *
+profile_create(size_t branches)
+{
+  profile_t *prof = profile_new();
+  int bits = 4;
+
+  while (((size_t)1 << bits) < 2 * branches) {
+    bits++;
+  }
+  profile_alloc(prof, bits);
+  profile_reserve(prof, (size_t)1 << (bits - 1));
+  return prof;
+}
+
+profile_t *
+profile_create_dense(const uint32_t *pcs, uint32_t npcs)
+{
+  profile_t *prof = profile_new();
+
+  // The trace numbered the branches already, so the PCs are filled in
+  // up front and no table is needed
+  profile_reserve(prof, npcs + 1);
+  memset(prof->entries, 0, (npcs + 1) * sizeof(profile_entry_t));
+  for (uint32_t i = 0; i < npcs; i++) {
+    prof->entries[i].pc = pcs[i];
+  }
+  prof->count = npcs;
+  return prof;
+}
+
+// Give 'pc' the next ID, growing the table first if that would fill it
+// past half
+//
+static uint32_t
+profile_insert(profile_t *prof, uint32_t pc)
+{
+  if (2 * (prof->count + 1) > prof->mask) {
+    profile_grow(prof);
+  }
+  if (prof->count == prof->capacity) {
+    profile_reserve(prof, 2 * prof->capacity);
+  }
+
+  uint32_t h = profile_hash(prof, pc);
+  while (prof->slots[h].id != 0) {
+    h = (h + 1) & prof->mask;
+  }
+  uint32_t id = prof->count++;
+  prof->slots[h].pc = pc;
+  prof->slots[h].id = id + 1;
+  memset(&prof->entries[id], 0, sizeof(profile_entry_t));
+  prof->entries[id].pc = pc;
+  return id;
+}
+
+// Make room for 'n' more branches in the packed counts
+//
+static inline void
+profile_pend(profile_t *prof, size_t n)
+{
+  if (prof->pending + n > PACK_MASK) {
+    profile_fold(prof);
+  }
+  prof->pending += n;
+}
+
+// Count 'n' branches given by their PCs
+//
+static void
+profile_count(profile_t *prof, const uint32_t *pc, const uint8_t *outcome,
+              const uint8_t *prediction, size_t n)
+{
+  // Work on copies, which insertion refreshes when it moves the arrays
+  profile_slot_t *slots = prof->slots;
+  uint64_t *packed = prof->packed;
+  uint32_t mask = prof->mask;
+  int shift = prof->shift;
+
+  profile_pend(prof, n);
+  for (size_t i = 0; i < n; i++) {
+    uint64_t miss = outcome[i] ^ prediction[i];
+    uint32_t h = (pc[i] * 0x9E3779B1u) >> shift;
+    uint32_t id;
+
+    while ((id = slots[h].id) == 0 || slots[h].pc != pc[i]) {
+      if (id == 0) {
+        id = profile_insert(prof, pc[i]) + 1;
+        slots = prof->slots;
+        packed = prof->packed;
+        mask = prof->mask;
+        shift = prof->shift;
+        break;
+      }
+      h = (h + 1) & mask;
+    }
+    packed[id - 1] += 1 | miss << PACK_BITS |
+                      (uint64_t)outcome[i] << (2 * PACK_BITS);
+  }
+}
+
+// Count 'n' branches given by their dense IDs
+//
+static void
+profile_count_ids(profile_t *prof, const uint32_t *id,
+                  const uint8_t *outcome, const uint8_t *prediction, size_t n)
+{
+  uint64_t *packed = prof->packed;
+
+  profile_pend(prof, n);
+  for (size_t i = 0; i < n; i++) {
+    uint64_t miss = outcome[i] ^ prediction[i];
+    packed[id[i]] += 1 | miss << PACK_BITS |
+                     (uint64_t)outcome[i] << (2 * PACK_BITS);
+  }
+}
+
+static void
+profile_task(void *arg)
+{
+  profile_batch_t *b = arg;
+
+  if (b->prof->slots == NULL) {
+    profile_count_ids(b->prof, b->key, b->outcome, b->prediction, b->n);
+  } else {
+    profile_count(b->prof, b->key, b->outcome, b->prediction, b->n);
+  }
+}
+
+// Hand the filled batch to the helper once it is done with the other,
+// which then starts filling
+//
+static void
+profile_hand_off(profile_t *prof)
+{
+  profile_batch_t *b = &prof->batch[prof->filling];
+
+  pool_wait(prof->pool);
+  if (b->n > 0) {
+    pool_submit(prof->pool, profile_task, b);
+  }
+  prof->filling ^= 1;
+  prof->batch[prof->filling].n = 0;
+}
+
+// Copy 'n' branches into the batches, handing each off as it fills
+//
+static void
+profile_queue(profile_t *prof, const uint32_t *key, const uint8_t *outcome,
+              const uint8_t *prediction, size_t n)
+{
+  while (n > 0) {
+    profile_batch_t *b = &prof->batch[prof->filling];
+    size_t m = PROFILE_BATCH - b->n;
+    if (m > n) {
+      m = n;
+    }
+    memcpy(b->key + b->n, key, m * sizeof(uint32_t));
+    memcpy(b->outcome + b->n, outcome, m);
+    memcpy(b->prediction + b->n, prediction, m);
+    b->n += m;
+    if (b->n == PROFILE_BATCH) {
+      profile_hand_off(prof);
+    }
+    key += m;
+    outcome += m;
+    prediction += m;
+    n -= m;
+  }
+}
+
+// Finish counting every branch added so far and fold the counts
+//
+static void
+profile_sync(profile_t *prof)
+{
+  if (prof->pool != NULL) {
+    profile_hand_off(prof);
+    pool_wait(prof->pool);
+  }
+  profile_fold(prof);
+}
+
+void
+profile_add(profile_t *prof, const uint32_t *pc, const uint8_t *outcome,
+            const uint8_t *prediction, size_t n)
+{
+  if (prof->pool != NULL) {
+    profile_queue(prof, pc, outcome, prediction, n);
+  } else {
+    profile_count(prof, pc, outcome, prediction, n);
+  }
+}
+
+void
+profile_add_ids(profile_t *prof, const uint32_t *id, const uint8_t *outcome,
+                const uint8_t *prediction, size_t n)
+{
+  if (prof->pool != NULL) {
+    profile_queue(prof, id, outcome, prediction, n);
+  } else {
+    profile_count_ids(prof, id, outcome, prediction, n);
+  }
+}
+
+static int
+by_mispredictions(const void *a, const void *b)
+{
+  const profile_entry_t *x = a;
+  const profile_entry_t *y = b;
+  if (x->mispredictions != y->mispredictions) {
+    return x->mispredictions < y->mispredictions ? 1 : -1;
+  }
+  if (x->executions != y->executions) {
+    return x->executions < y->executions ? 1 : -1;
+  }
+  return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+// Gather the executed branches into a new array, most mispredictions
+// first, and count them into '*count'
+//
+static profile_entry_t *
+profile_sorted(profile_t *prof, size_t *count)
+{
+  profile_entry_t *entries = malloc((prof->count + 1) *
+                                    sizeof(profile_entry_t));
+  size_t n = 0;
+
+  profile_sync(prof);
+  for (size_t i = 0; i < prof->count; i++) {
+    if (prof->entries[i].executions != 0) {
+      entries[n++] = prof->entries[i];
+    }
+  }
+  qsort(entries, n, sizeof(profile_entry_t), by_mispredictions);
+  *count = n;
+  return entries;
+}
+
+void
+profile_print(profile_t *prof, FILE *out, int top)
+{
+  size_t count;
+  profile_entry_t *entries = profile_sorted(prof, &count);
+
+  if ((size_t)top > count) {
+    top = count;
+  }
+  fprintf(out, "Static Branches: %10zu\n", count);
+  fprintf(out, "%-12s %10s %10s %8s %8s %8s\n", "PC", "Executions",
+          "Incorrect", "Rate", "Taken", "Share");
+  for (int i = 0; i < top; i++) {
+    const profile_entry_t *e = &entries[i];
+    fprintf(out, "0x%-10x %10llu %10llu %8.3f %8.3f %8.3f\n", e->pc,
+            (unsigned long long)e->executions,
+            (unsigned long long)e->mispredictions,
+            100 * (double)e->mispredictions / e->executions,
+            100 * (double)e->taken / e->executions,
+            prof->mispredictions ?
+                100 * (double)e->mispredictions / prof->mispredictions : 0);
+  }
+  free(entries);
+}
+
+int
+profile_write_csv(profile_t *prof, const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    return 0;
+  }
+
+  size_t count;
+  profile_entry_t *entries = profile_sorted(prof, &count);
+  fprintf(f, "pc,executions,incorrect,taken\n");
+  for (size_t i = 0; i < count; i++) {
+    fprintf(f, "0x%x,%llu,%llu,%llu\n", entries[i].pc,
+            (unsigned long long)entries[i].executions,
+            (unsigned long long)entries[i].mispredictions,
+            (unsigned long long)entries[i].taken);
+  }
+  free(entries);
+  int ok = !ferror(f);
+  return (fclose(f) == 0) && ok;
+}
+
+void
+profile_destroy(profile_t *prof)
+{
+  if (prof == NULL) {
+    return;
+  }
+  if (prof->pool != NULL) {
+    pool_destroy(prof->pool);
+    for (int i = 0; i < 2; i++) {
+      free(prof->batch[i].key);
+      free(prof->batch[i].outcome);
+      free(prof->batch[i].prediction);
+    }
+  }
+  free(prof->slots);
+  free(prof->entries);
+  free(prof->packed);
+  free(prof);
+}
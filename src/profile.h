@@ -0,0 +1,58 @@
+//========================================================//
+//  profile.h                                             //
+//  Header file for the per-branch profiler               //
+//                                                        //
+//  Counts executions, mispredictions and taken outcomes  //
+//  of every static branch of a run                       //
+//========================================================//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct profile profile_t;
+
+// Create an empty profile with room for about 'branches' static
+// branches before it first grows
+//
+profile_t *profile_create(size_t branches);
+
+// Create an empty profile of the 'npcs' static branches numbered by
+// trace_buf_index, whose PCs are 'pcs'; counted with profile_add_ids
+// into a flat array instead of the hash table
+//
+profile_t *profile_create_dense(const uint32_t *pcs, uint32_t npcs);
+
+// Count a block of 'n' branches with the predictions made for them.
+// The block is copied, and on a machine with a core to spare counted
+// on a helper thread while the caller goes on; the results below wait
+// for it.
+//
+void profile_add(profile_t *prof, const uint32_t *pc, const uint8_t *outcome,
+                 const uint8_t *prediction, size_t n);
+
+// Count a block of 'n' branches of a dense profile, given by their
+// IDs instead of their PCs
+//
+void profile_add_ids(profile_t *prof, const uint32_t *id,
+                     const uint8_t *outcome, const uint8_t *prediction,
+                     size_t n);
+
+// Print the 'top' branches with the most mispredictions to 'out'
+//
+void profile_print(profile_t *prof, FILE *out, int top);
+
+// Write every branch, most mispredictions first, as CSV to 'path'
+//
+// Returns True if Successful, with errno set otherwise
+//
+int profile_write_csv(profile_t *prof, const char *path);
+
+// Release the profile
+//
+void profile_destroy(profile_t *prof);
+
+#endif
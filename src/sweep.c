@@ -0,0 +1,194 @@
+//========================================================//
+//  sweep.c                                               //
+//  Source file for the multi-configuration sweep mode    //
+//                                                        //
+//  The trace is decoded once into memory; every         //
+//  configuration is then a pool task replaying the same  //
+//  arrays through a private predictor                    //
+//========================================================//
+
+#include <stdio.h>
+#include <string.h>
+#include "pool.h"
+#include "sweep.h"
+
+// Branches per simulate call, well below the 32-bit miss count's range
+#define SWEEP_SLICE ((size_t)1 << 30)
+
+// Grid swept when no predictor options are given
+static char *default_specs[] = { "gshare:8-24", "tournament:9-13:9-11:9-11" };
+
+typedef struct {
+  const trace_buf_t *tb;
+  const predictor_config_t *config;
+  sweep_result_t *result;
+} sweep_job_t;
+
+int
+sweep_expand(const char *spec, predictor_config_t **configs, int *n)
+{
+  char name[32];
+  int lo[4], hi[4], v[4];
+  int nfields = 0;
+
+  // Split "<name>[:<lo>[-<hi>]]..." into its scheme name and ranges
+  const char *p = strchr(spec, ':');
+  size_t nlen = p ? (size_t)(p - spec) : strlen(spec);
+  if (nlen >= sizeof(name)) {
+    return 0;
+  }
+  memcpy(name, spec, nlen);
+  name[nlen] = '\0';
+  while (p != NULL) {
+    char *end;
+    if (nfields == 4) {
+      return 0;
+    }
+    lo[nfields] = strtol(p + 1, &end, 10);
+    if (end == p + 1) {
+      return 0;
+    }
+    hi[nfields] = lo[nfields];
+    if (*end == '-') {
+      const char *q = end + 1;
+      hi[nfields] = strtol(q, &end, 10);
+      if (end == q || hi[nfields] < lo[nfields]) {
+        return 0;
+      }
+    }
+    if (*end != ':' && *end != '\0') {
+      return 0;
+    }
+    v[nfields] = lo[nfields];
+    nfields++;
+    p = (*end == ':') ? end : NULL;
+  }
+
+  // Walk every point of the grid, last field fastest
+  for (;;) {
+    char point[64];
+    int len = snprintf(point, sizeof(point), "%s", name);
+    for (int i = 0; i < nfields; i++) {
+      len += snprintf(point + len, sizeof(point) - len, ":%d", v[i]);
+    }
+
+    predictor_config_t config;
+    if (!predictor_parse(point, &config)) {
+      return 0;
+    }
+    *configs = realloc(*configs, (*n + 1) * sizeof(predictor_config_t));
+    (*configs)[(*n)++] = config;
+
+    int i = nfields - 1;
+    while (i >= 0 && v[i] == hi[i]) {
+      v[i] = lo[i];
+      i--;
+    }
+    if (i < 0) {
+      break;
+    }
+    v[i]++;
+  }
+  return 1;
+}
+
+uint64_t
+sweep_replay(predictor_t *p, const trace_buf_t *tb, size_t start, size_t end)
+{
+  uint64_t mispredictions = 0;
+
+  // The batch counts in 32 bits, so longer ranges go in slices
+  for (size_t i = start; i < end; i += SWEEP_SLICE) {
+    size_t n = end - i < SWEEP_SLICE ? end - i : SWEEP_SLICE;
+    mispredictions += predictor_simulate_batch(p, tb->pc + i, tb->outcome + i,
+                                               n, NULL);
+  }
+  return mispredictions;
+}
+
+sweep_result_t
+sweep_simulate(const predictor_config_t *config, const trace_buf_t *tb)
+{
+  predictor_t *p = predictor_create(config);
+  sweep_result_t r = { 0, 0 };
+
+  r.mispredictions = sweep_replay(p, tb, 0, tb->n);
+  r.num_branches = tb->n;
+
+  predictor_destroy(p);
+  return r;
+}
+
+static void
+sweep_task(void *arg)
+{
+  sweep_job_t *job = arg;
+  *job->result = sweep_simulate(job->config, job->tb);
+}
+
+void
+sweep_run(const trace_buf_t *tb, const predictor_config_t *configs,
+          int n, int threads, sweep_result_t *results)
+{
+  sweep_job_t *jobs = malloc(n * sizeof(sweep_job_t));
+
+  if (threads > n) {
+    threads = n;
+  }
+  pool_t *pool = pool_create(threads);
+  for (int i = 0; i < n; i++) {
+    jobs[i].tb = tb;
+    jobs[i].config = &configs[i];
+    jobs[i].result = &results[i];
+    pool_submit(pool, sweep_task, &jobs[i]);
+  }
+  pool_destroy(pool);
+  free(jobs);
+}
+
+int
+sweep_main(const char *path, char **specs, int nspecs, int threads)
+{
+  predictor_config_t *configs = NULL;
+  int n = 0;
+
+  if (nspecs == 0) {
+    specs = default_specs;
+    nspecs = sizeof(default_specs) / sizeof(default_specs[0]);
+  }
+  for (int i = 0; i < nspecs; i++) {
+    if (!sweep_expand(specs[i], &configs, &n)) {
+      fprintf(stderr, "Invalid sweep scheme --%s\n", specs[i]);
+      return 1;
+    }
+  }
+
+  // Decode the trace once for every configuration
+  trace_buf_t tb;
+  char err[128];
+  if (!trace_load(path, &tb, err, sizeof(err))) {
+    fprintf(stderr, "%s: %s\n", path ? path : "stdin", err);
+    return 1;
+  }
+
+  sweep_result_t *results = calloc(n, sizeof(sweep_result_t));
+  sweep_run(&tb, configs, n, threads, results);
+
+  printf("%-24s %10s %10s %18s %12s\n", "Predictor", "Branches", "Incorrect",
+         "Misprediction Rate", "Bits");
+  for (int i = 0; i < n; i++) {
+    char name[64];
+    predictor_format(&configs[i], name, sizeof(name));
+    float mispredict_rate =
+        100*((float)results[i].mispredictions / (float)results[i].num_branches);
+    printf("%-24s %10llu %10llu %18.3f %12llu\n", name,
+           (unsigned long long)results[i].num_branches,
+           (unsigned long long)results[i].mispredictions, mispredict_rate,
+           (unsigned long long)predictor_bits(&configs[i]));
+  }
+
+  free(results);
+  free(configs);
+  trace_buf_free(&tb);
+  return 0;
+}
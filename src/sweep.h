@@ -0,0 +1,57 @@
+//========================================================//
+//  sweep.h                                               //
+//  Header file for the multi-configuration sweep mode    //
+//                                                        //
+//  A trace is decoded once and replayed through many     //
+//  predictor configurations on a pool of threads         //
+//========================================================//
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+
+// Outcome of simulating one configuration over one trace
+typedef struct {
+  uint64_t num_branches;
+  uint64_t mispredictions;
+} sweep_result_t;
+
+// Expand a scheme with optional ranges in its numeric fields, e.g.
+// "gshare:8-24" or "tournament:9-13:10:10", appending every point to
+// 'configs' (grown as needed)
+//
+// Returns True if Successful
+//
+int sweep_expand(const char *spec, predictor_config_t **configs, int *n);
+
+// Replay branches 'start' to 'end' - 1 of 'tb' through 'p'; unlike a
+// single predictor_simulate_batch call, any number of them
+//
+// Returns the number of mispredictions
+//
+uint64_t sweep_replay(predictor_t *p, const trace_buf_t *tb,
+                      size_t start, size_t end);
+
+// Replay the whole of 'tb' through a fresh predictor built from 'config'
+//
+sweep_result_t sweep_simulate(const predictor_config_t *config,
+                              const trace_buf_t *tb);
+
+// Replay 'tb' through each of the 'n' configurations on 'threads'
+// pool threads (0 uses one per core), filling results[i] for configs[i]
+//
+void sweep_run(const trace_buf_t *tb, const predictor_config_t *configs,
+               int n, int threads, sweep_result_t *results);
+
+// Sweep mode of the predictor: simulate every point of 'specs' (or a
+// default gshare/tournament grid) over the trace at 'path' and print
+// one results table
+//
+// Returns the process exit status
+//
+int sweep_main(const char *path, char **specs, int nspecs, int threads);
+
+#endif
@@ -0,0 +1,63 @@
+//========================================================//
+//  timing.c                                              //
+//  Source file for the main loop stage timers            //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "timing.h"
+
+#ifndef NO_TIMING
+
+int timing;
+uint64_t timingNs[TIMING_STAGES];
+uint64_t timingLast;
+
+static const char *stageName[TIMING_STAGES] = { "read", "simulate",
+                                                "profile", "output" };
+
+void
+timing_report(uint64_t branches, int json)
+{
+  uint64_t total = 0;
+  int first = 1;
+
+  for (int s = 0; s < TIMING_STAGES; s++) {
+    total += timingNs[s];
+  }
+  if (branches == 0) {
+    branches = 1;
+  }
+
+  if (json) {
+    fprintf(stderr, "{ \"branches\": %llu, \"stages\": {",
+            (unsigned long long)branches);
+  } else {
+    fprintf(stderr, "%-10s %12s %10s %16s %8s\n", "Stage", "Seconds",
+            "ns/branch", "Branches/sec", "Share");
+  }
+  for (int s = 0; s <= TIMING_STAGES; s++) {
+    // The last row is the whole loop
+    uint64_t ns = s < TIMING_STAGES ? timingNs[s] : total;
+    const char *name = s < TIMING_STAGES ? stageName[s] : "total";
+    double per = (double)ns / branches;
+    double rate = ns ? branches * 1e9 / ns : 0;
+    if (ns == 0 && s < TIMING_STAGES) {
+      continue;
+    }
+    if (json) {
+      fprintf(stderr, "%s \"%s\": { \"seconds\": %.6f, \"ns_per_branch\": %.3f, "
+              "\"branches_per_sec\": %.0f }", first ? "" : ",", name,
+              ns * 1e-9, per, rate);
+    } else {
+      fprintf(stderr, "%-10s %12.6f %10.3f %16.0f %7.1f%%\n", name, ns * 1e-9,
+              per, rate, total ? 100.0 * ns / total : 0);
+    }
+    first = 0;
+  }
+  if (json) {
+    fprintf(stderr, " } }\n");
+  }
+}
+
+#endif
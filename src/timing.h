@@ -0,0 +1,68 @@
+//========================================================//
+//  timing.h                                              //
+//  Header file for the main loop stage timers            //
+//                                                        //
+//  Time is charged to a stage per block of branches, so  //
+//  the clock is read a few times per 4096 branches; with //
+//  NO_TIMING defined every hook compiles to nothing      //
+//========================================================//
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+// Stages of the main loop
+#define STAGE_READ      0   // Trace decoding (trace_read)
+#define STAGE_SIMULATE  1   // Predicting and training, fused
+#define STAGE_PROFILE   2   // Per-branch profile (--profile-pcs)
+#define STAGE_OUTPUT    3   // Writing predictions (--verbose, --packed)
+#define TIMING_STAGES   4
+
+#ifndef NO_TIMING
+
+#include <time.h>
+
+extern int timing;                          // Timers running
+extern uint64_t timingNs[TIMING_STAGES];    // Time charged to each stage
+extern uint64_t timingLast;                 // Clock at the last lap
+
+static inline uint64_t
+timing_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Start the clock
+#define TIMING_START()                                                  \
+  do {                                                                  \
+    if (timing) {                                                       \
+      timingLast = timing_now();                                        \
+    }                                                                   \
+  } while (0)
+
+// Charge the time since the last lap to 'stage'
+#define TIMING_LAP(stage)                                               \
+  do {                                                                  \
+    if (timing) {                                                       \
+      uint64_t now_ = timing_now();                                     \
+      timingNs[stage] += now_ - timingLast;                             \
+      timingLast = now_;                                                \
+    }                                                                   \
+  } while (0)
+
+// Print ns/branch and branches/sec of every stage that ran to stderr,
+// as a table or, with 'json', as a JSON object
+//
+void timing_report(uint64_t branches, int json);
+
+#else
+
+#define TIMING_START()          do { } while (0)
+#define TIMING_LAP(stage)       do { } while (0)
+
+#endif
+
+#endif
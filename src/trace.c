@@ -0,0 +1,1006 @@
+//========================================================//
+//  trace.c                                               //
+//  Source file for the Branch Trace readers and writers  //
+//                                                        //
+//  Text traces are parsed from a large read buffer with  //
+//  SIMD line scanning, binary traces are mmap'd and      //
+//  decoded block by block                                //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <bzlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bz2reader.h"
+#include "trace.h"
+
+#define TEXT_CHUNK (1 << 20)  // Bytes requested per read() of a text trace
+#define TEXT_PAD   64         // Readable slack past the end of the text buffer
+#define TRACE_RELEASE (64 << 20)  // Bytes of input dropped at a time
+
+// Trace Formats
+#define FORMAT_TEXT    0
+#define FORMAT_BINARY  1
+
+int traceThreads;  // Decompression threads (0 uses one per core)
+
+struct trace {
+  int format;
+  int fd;
+  char error[128];
+
+  // Text traces: raw input buffer and line accounting
+  char *buf;
+  size_t cap, len, pos;
+  int eof;
+  uint64_t line;
+  uint64_t consumed;     // Bytes read from the file
+  uint64_t size;         // Size of the file, 0 for a pipe
+
+  // Compressed text traces: decompressed chunk being consumed
+  bz2_reader_t *bz;
+  const char *chunk;
+  size_t chunk_len, chunk_pos;
+
+  // Compressed text read from a pipe, which the parallel reader cannot
+  // map: decompressed serially from a TEXT_CHUNK input buffer
+  bz_stream *bzs;
+  char *bz_in;
+  int bz_between;        // At a stream boundary, where the input may end
+
+  // Binary traces: whole file image and block decoder state
+  const uint8_t *image;
+  size_t image_len;
+  int mapped;
+  size_t map_len;        // Bytes mapped at image
+  uint64_t released;     // Pages before this offset were dropped
+  uint64_t index_released;
+  trace_bin_header_t hdr;
+  const uint64_t *index;
+  uint64_t counted;      // Branches in the blocks loaded so far
+  uint32_t next_block;   // Next block to load
+  uint32_t block_left;   // Branches left in the current block
+  const uint8_t *bits;   // Outcome bits of the current block
+  uint32_t bit;          // Next outcome bit
+  const uint8_t *vp;     // Next pc varint
+  const uint8_t *vend;   // End of the pc varints
+  uint32_t prev_pc;
+};
+
+//------------------------------------//
+//          Varint Helpers            //
+//------------------------------------//
+
+static inline uint32_t
+zigzag_encode(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t
+zigzag_decode(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline uint8_t *
+varint_put(uint8_t *p, uint32_t v)
+{
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+// Returns the position after the varint, or NULL if it is truncated
+// or longer than 5 bytes
+//
+static inline const uint8_t *
+varint_get(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+  uint32_t x = 0;
+  for (int shift = 0; shift < 35 && p < end; shift += 7) {
+    uint8_t b = *p++;
+    x |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *v = x;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// Drop the pages of the input from '*released' up to byte 'upto' once
+// they add up to TRACE_RELEASE.  Inputs are read front to back, so
+// however long the trace, only the part being decoded stays resident.
+// A mapped file page touched again is simply read back.  Text read
+// from a file leaves the page cache instead.
+//
+static void
+image_release(trace_t *t, uint64_t *released, uint64_t upto)
+{
+  if (upto < *released + TRACE_RELEASE) {
+    return;
+  }
+  if (t->mapped) {
+    upto &= ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    madvise((void *)(t->image + *released), upto - *released, MADV_DONTNEED);
+  } else if (t->size > 0) {
+    posix_fadvise(t->fd, *released, upto - *released, POSIX_FADV_DONTNEED);
+  } else {
+    return;
+  }
+  *released = upto;
+}
+
+//------------------------------------//
+//           Text Traces              //
+//------------------------------------//
+
+// Decompress up to 'max' bytes of the piped bzip2 input into 'dst'.
+// Streams may follow one another, as pbzip2 writes them.
+//
+// Returns the number of bytes decompressed, 0 at end of input or on
+// error
+//
+static size_t
+bz_pipe_source(trace_t *t, char *dst, size_t max)
+{
+  bz_stream *s = t->bzs;
+
+  s->next_out = dst;
+  s->avail_out = max;
+  while (s->avail_out == max) {
+    if (s->avail_in == 0) {
+      ssize_t got;
+      do {
+        got = read(t->fd, t->bz_in, TEXT_CHUNK);
+      } while (got < 0 && errno == EINTR);
+      if (got <= 0) {
+        if (!t->bz_between) {
+          snprintf(t->error, sizeof(t->error), "truncated bzip2 stream");
+        }
+        return 0;
+      }
+      s->next_in = t->bz_in;
+      s->avail_in = got;
+      t->consumed += got;
+    }
+
+    int ret = BZ2_bzDecompress(s);
+    t->bz_between = 0;
+    if (ret == BZ_STREAM_END) {
+      // Start over on whatever input follows the stream
+      char *next_in = s->next_in;
+      unsigned int avail_in = s->avail_in;
+      char *next_out = s->next_out;
+      unsigned int avail_out = s->avail_out;
+      BZ2_bzDecompressEnd(s);
+      BZ2_bzDecompressInit(s, 0, 0);
+      s->next_in = next_in;
+      s->avail_in = avail_in;
+      s->next_out = next_out;
+      s->avail_out = avail_out;
+      t->bz_between = 1;
+    } else if (ret != BZ_OK) {
+      snprintf(t->error, sizeof(t->error), "bzip2 data error");
+      return 0;
+    }
+  }
+  return max - s->avail_out;
+}
+
+// Copy up to 'max' raw text bytes from the input into 'dst'
+//
+// Returns the number of bytes copied, 0 at end of input or on error
+//
+static size_t
+text_source(trace_t *t, char *dst, size_t max)
+{
+  if (t->bzs != NULL) {
+    return bz_pipe_source(t, dst, max);
+  }
+  if (t->bz == NULL) {
+    ssize_t got;
+    do {
+      got = read(t->fd, dst, max);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+      return 0;
+    }
+    t->consumed += got;
+    image_release(t, &t->released, t->consumed);
+    return got;
+  }
+
+  while (t->chunk_pos == t->chunk_len) {
+    t->chunk = bz2_reader_next(t->bz, &t->chunk_len);
+    t->chunk_pos = 0;
+    if (t->chunk == NULL) {
+      if (bz2_reader_error(t->bz) != NULL) {
+        snprintf(t->error, sizeof(t->error), "%s", bz2_reader_error(t->bz));
+      }
+      t->chunk_len = 0;
+      return 0;
+    }
+    image_release(t, &t->released, bz2_reader_position(t->bz));
+  }
+  size_t n = t->chunk_len - t->chunk_pos;
+  if (n > max) {
+    n = max;
+  }
+  memcpy(dst, t->chunk + t->chunk_pos, n);
+  t->chunk_pos += n;
+  return n;
+}
+
+// Read more input into the text buffer, keeping the unparsed tail.
+// TEXT_PAD bytes past the data are always allocated so the parser may
+// load whole vectors across the end of the buffer.
+//
+// Returns False at end of input
+//
+static int
+text_fill(trace_t *t)
+{
+  if (t->eof) {
+    return 0;
+  }
+
+  // Slide the partial line to the front and make room for a full chunk
+  memmove(t->buf, t->buf + t->pos, t->len - t->pos);
+  t->len -= t->pos;
+  t->pos = 0;
+  if (t->cap - t->len < TEXT_CHUNK + TEXT_PAD) {
+    t->cap = t->len + TEXT_CHUNK + TEXT_PAD;
+    t->buf = realloc(t->buf, t->cap);
+  }
+
+  size_t got = text_source(t, t->buf + t->len, TEXT_CHUNK);
+  memset(t->buf + t->len + got, 0, TEXT_PAD);
+  if (got == 0) {
+    t->eof = 1;
+    return t->len > 0;
+  }
+  t->len += got;
+  return 1;
+}
+
+// Hex digit values plus one, 0 for anything that is not a hex digit
+static const uint8_t hex_value[256] = {
+  ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+  ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+  ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+// Decode the 'd' (1..8) hex digits at 's'
+//
+// Returns True if Successful
+//
+static inline int
+hex_scalar(const char *s, int d, uint32_t *out)
+{
+  uint32_t v = 0;
+  for (int i = 0; i < d; i++) {
+    uint32_t h = hex_value[(uint8_t)s[i]];
+    if (h == 0) {
+      return 0;
+    }
+    v = (v << 4) | (h - 1);
+  }
+  *out = v;
+  return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Decode the 'd' (1..8) hex digits at 's' with one 16-byte load: map
+// every byte to its nibble, right-align the digits with a shuffle and
+// merge nibble pairs into bytes with a multiply-add
+//
+__attribute__((target("ssse3")))
+static inline int
+hex_ssse3(const char *s, int d, uint32_t *out)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)s);
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i is_dig = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+  __m128i is_alp = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                 _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+  uint32_t valid = _mm_movemask_epi8(_mm_or_si128(is_dig, is_alp));
+  uint32_t need = (1u << d) - 1;
+  if ((valid & need) != need) {
+    return 0;
+  }
+
+  __m128i nib = _mm_or_si128(
+      _mm_and_si128(is_dig, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+      _mm_andnot_si128(is_dig, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+  // Negative shuffle indices clear the leading nibbles
+  __m128i idx = _mm_sub_epi8(_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                           8, 9, 10, 11, 12, 13, 14, 15),
+                             _mm_set1_epi8(8 - d));
+  nib = _mm_shuffle_epi8(nib, idx);
+  __m128i bytes = _mm_maddubs_epi16(nib, _mm_set1_epi16(0x0110));
+  bytes = _mm_packus_epi16(bytes, bytes);
+  *out = __builtin_bswap32((uint32_t)_mm_cvtsi128_si32(bytes));
+  return 1;
+}
+#endif
+
+// Parse one line of 'len' bytes (without the newline) the way
+// sscanf("0x%x %u") would, for lines off the fast path
+//
+// Returns True if Successful
+//
+static int
+parse_line_slow(char *line, size_t len, uint32_t *pc, uint8_t *outcome)
+{
+  char save = line[len];
+  uint32_t tmp;
+
+  line[len] = '\0';
+  int ok = sscanf(line, "0x%x %u", pc, &tmp) == 2 && tmp <= 1;
+  line[len] = save;
+  *outcome = tmp;
+  return ok;
+}
+
+// Parse the complete lines buffered in buf[pos, len) into up to 'max'
+// branches.  Newlines are located 16 bytes at a time with SSE2 and
+// each "0x<hex> <bit>" line is decoded by HEX; anything unusual falls
+// back to parse_line_slow.
+//
+// Returns the number of branches, or (size_t)-1 on a malformed line
+//
+#define TEXT_PARSE_BODY(HEX)                                                \
+  char *buf = t->buf;                                                       \
+  size_t pos = t->pos;                                                      \
+  size_t scan = pos;                                                        \
+  uint32_t mask = 0;                                                        \
+  size_t n = 0;                                                             \
+                                                                            \
+  while (n < max) {                                                         \
+    while (mask == 0) {                                                     \
+      if (scan >= t->len) {                                                 \
+        goto done;                                                          \
+      }                                                                     \
+      mask = newline_mask(buf + scan);                                      \
+      if (t->len - scan < 16) {                                             \
+        mask &= (1u << (t->len - scan)) - 1;                                \
+      }                                                                     \
+      scan += 16;                                                           \
+    }                                                                       \
+    size_t nl = scan - 16 + __builtin_ctz(mask);                            \
+    mask &= mask - 1;                                                       \
+                                                                            \
+    char *line = buf + pos;                                                 \
+    size_t len = nl - pos;                                                  \
+    pos = nl + 1;                                                           \
+    t->line++;                                                              \
+    if (len > 0 && line[len - 1] == '\r') {                                 \
+      len--;                                                                \
+    }                                                                       \
+    if (len == 0) {                                                         \
+      continue;                                                             \
+    }                                                                       \
+    if (len >= 5 && len <= 12 && line[0] == '0' && line[1] == 'x' &&        \
+        line[len - 2] == ' ' && (uint8_t)(line[len - 1] - '0') <= 1 &&      \
+        HEX(line + 2, (int)len - 4, &pc[n])) {                              \
+      outcome[n++] = line[len - 1] - '0';                                   \
+    } else if (parse_line_slow(line, len, &pc[n], &outcome[n])) {           \
+      n++;                                                                  \
+    } else {                                                                \
+      t->pos = pos;                                                         \
+      return (size_t)-1;                                                    \
+    }                                                                       \
+  }                                                                         \
+done:                                                                       \
+  t->pos = pos;                                                             \
+  return n;
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint32_t
+newline_mask(const char *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+}
+
+__attribute__((target("ssse3")))
+static size_t
+text_parse_ssse3(trace_t *t, uint32_t *pc, uint8_t *outcome, size_t max)
+{
+  TEXT_PARSE_BODY(hex_ssse3)
+}
+#else
+static inline uint32_t
+newline_mask(const char *p)
+{
+  uint32_t mask = 0;
+  for (int i = 0; i < 16; i++) {
+    mask |= (uint32_t)(p[i] == '\n') << i;
+  }
+  return mask;
+}
+#endif
+
+static size_t
+text_parse_scalar(trace_t *t, uint32_t *pc, uint8_t *outcome, size_t max)
+{
+  TEXT_PARSE_BODY(hex_scalar)
+}
+
+static size_t
+text_read(trace_t *t, uint32_t *pc, uint8_t *outcome, size_t max)
+{
+  size_t (*parse)(trace_t *, uint32_t *, uint8_t *, size_t) = text_parse_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("ssse3")) {
+    parse = text_parse_ssse3;
+  }
+#endif
+  size_t n = 0;
+
+  while (n < max) {
+    size_t got = parse(t, pc + n, outcome + n, max - n);
+    if (got == (size_t)-1) {
+      snprintf(t->error, sizeof(t->error),
+               "malformed branch on line %llu", (unsigned long long)t->line);
+      return 0;
+    }
+    n += got;
+    if (n == max) {
+      break;
+    }
+
+    // Out of complete lines: read more, or finish the unterminated last
+    // line at end of input
+    if (!t->eof) {
+      if (!text_fill(t) && t->len == 0) {
+        break;
+      }
+      if (t->error[0] != '\0') {
+        return 0;
+      }
+    } else if (t->pos < t->len) {
+      t->buf[t->len] = '\n';
+      t->len++;
+    } else {
+      break;
+    }
+  }
+
+  return n;
+}
+
+//------------------------------------//
+//          Binary Traces             //
+//------------------------------------//
+
+static int
+bin_error(trace_t *t, const char *what)
+{
+  snprintf(t->error, sizeof(t->error), "corrupt binary trace: %s", what);
+  return 0;
+}
+
+// Check the header and index of the binary image
+//
+// Returns True if Successful
+//
+static int
+bin_open(trace_t *t)
+{
+  if (t->image_len < sizeof(trace_bin_header_t)) {
+    return bin_error(t, "truncated header");
+  }
+  memcpy(&t->hdr, t->image, sizeof(trace_bin_header_t));
+  if (t->hdr.version != TRACE_BIN_VERSION) {
+    return bin_error(t, "unsupported version");
+  }
+  if (t->hdr.index_offset < sizeof(trace_bin_header_t) ||
+      t->hdr.index_offset > t->image_len ||
+      (t->image_len - t->hdr.index_offset) / sizeof(uint64_t) < t->hdr.num_blocks ||
+      (t->hdr.index_offset & 7) != 0) {
+    return bin_error(t, "truncated index");
+  }
+  t->index = (const uint64_t *)(t->image + t->hdr.index_offset);
+  t->index_released = t->hdr.index_offset & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+
+  // The blocks are checked as they are loaded, so that opening a trace
+  // does not read all of it
+  return 1;
+}
+
+// Position the decoder at the start of block 'b'
+//
+// Returns True if Successful
+//
+static int
+bin_load_block(trace_t *t, uint32_t b)
+{
+  const uint8_t *limit = t->image + t->hdr.index_offset;
+  uint32_t count, nbytes;
+
+  if (t->index[b] > t->hdr.index_offset - 2 * sizeof(uint32_t)) {
+    return bin_error(t, "block offset out of range");
+  }
+  image_release(t, &t->released, t->index[b]);
+  image_release(t, &t->index_released, t->hdr.index_offset + b * sizeof(uint64_t));
+
+  const uint8_t *p = t->image + t->index[b];
+  memcpy(&count, p, sizeof(count));
+  memcpy(&nbytes, p + 4, sizeof(nbytes));
+  p += 8;
+  if (count > t->hdr.block_size ||
+      (size_t)(limit - p) < (count + 7) / 8 ||
+      (size_t)(limit - p) - (count + 7) / 8 < nbytes) {
+    return bin_error(t, "block out of range");
+  }
+
+  t->bits = p;
+  t->bit = 0;
+  t->vp = p + (count + 7) / 8;
+  t->vend = t->vp + nbytes;
+  t->prev_pc = 0;
+  t->block_left = count;
+  t->counted += count;
+  return 1;
+}
+
+static size_t
+bin_read(trace_t *t, uint32_t *pc, uint8_t *outcome, size_t max)
+{
+  size_t n = 0;
+
+  while (n < max) {
+    if (t->block_left == 0) {
+      if (t->next_block == t->hdr.num_blocks) {
+        if (t->counted != t->hdr.num_branches) {
+          bin_error(t, "branch count mismatch");
+          return 0;
+        }
+        break;
+      }
+      if (!bin_load_block(t, t->next_block++)) {
+        return 0;
+      }
+      continue;
+    }
+
+    size_t take = max - n;
+    if (take > t->block_left) {
+      take = t->block_left;
+    }
+
+    const uint8_t *vp = t->vp;
+    const uint8_t *vend = t->vend;
+    const uint8_t *bits = t->bits;
+    uint32_t bit = t->bit;
+    uint32_t prev = t->prev_pc;
+
+    for (size_t i = 0; i < take; i++) {
+      uint32_t v;
+      if (vp < vend && *vp < 0x80) {
+        v = *vp++;
+      } else if ((vp = varint_get(vp, vend, &v)) == NULL) {
+        bin_error(t, "truncated pc stream");
+        return 0;
+      }
+      prev += (uint32_t)zigzag_decode(v);
+      pc[n + i] = prev;
+      outcome[n + i] = (bits[bit >> 3] >> (bit & 7)) & 1;
+      bit++;
+    }
+
+    t->vp = vp;
+    t->bit = bit;
+    t->prev_pc = prev;
+    t->block_left -= take;
+    n += take;
+  }
+
+  return n;
+}
+
+// Map the whole input file as t->image, so that image_release can drop
+// it.  The text buffer is left empty.  A pipe is refused: its blocks
+// could only be decoded in place by holding all of it.
+//
+// Returns True if Successful
+//
+static int
+load_image(trace_t *t)
+{
+  struct stat st;
+
+  if (fstat(t->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    snprintf(t->error, sizeof(t->error),
+             "binary traces cannot be read from a pipe");
+    return 0;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, t->fd, 0);
+  if (map == MAP_FAILED) {
+    snprintf(t->error, sizeof(t->error), "%s", strerror(errno));
+    return 0;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  t->image = map;
+  t->image_len = st.st_size;
+  t->map_len = st.st_size;
+  t->mapped = 1;
+  t->len = t->pos = 0;
+  return 1;
+}
+
+// Decompress the bzip2 stream read from a pipe serially, starting from
+// the bytes already buffered, which become its input buffer
+//
+// Returns True if Successful
+//
+static int
+bz_pipe_open(trace_t *t)
+{
+  t->bzs = calloc(1, sizeof(bz_stream));
+  if (BZ2_bzDecompressInit(t->bzs, 0, 0) != BZ_OK) {
+    free(t->bzs);
+    t->bzs = NULL;
+    snprintf(t->error, sizeof(t->error), "cannot start bzip2 decompression");
+    return 0;
+  }
+  t->bz_in = t->buf;
+  t->bzs->next_in = t->buf;
+  t->bzs->avail_in = t->len;
+  t->buf = NULL;
+  t->cap = t->len = t->pos = 0;
+  t->eof = 0;
+  return 1;
+}
+
+//------------------------------------//
+//       Trace Reader Functions       //
+//------------------------------------//
+
+trace_t *
+trace_open(const char *path)
+{
+  trace_t *t = calloc(1, sizeof(trace_t));
+
+  t->fd = 0;
+  if (path != NULL && (t->fd = open(path, O_RDONLY)) < 0) {
+    free(t);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(t->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    t->size = st.st_size;
+  }
+
+  // Peek at the start of the input to pick a decoder
+  t->format = FORMAT_TEXT;
+  while (t->len < 4 && text_fill(t)) {
+    if (t->eof) {
+      break;
+    }
+  }
+  if (t->len >= 4 && !memcmp(t->buf, TRACE_BIN_MAGIC, 4)) {
+    t->format = FORMAT_BINARY;
+    if (!load_image(t) || !bin_open(t)) {
+      // Surface the error on the first read
+      t->hdr.num_blocks = 0;
+      t->next_block = 0;
+    }
+  } else if (bz2_detect((const uint8_t *)t->buf, t->len)) {
+    // Compressed text: decompress the whole image in parallel and parse
+    // the output as it arrives, or a pipe as it is read
+    int threads = traceThreads;
+    if (threads <= 0) {
+      threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (t->size == 0) {
+      bz_pipe_open(t);
+    } else if (load_image(t)) {
+      t->bz = bz2_reader_open(t->image, t->image_len, threads);
+    }
+  }
+
+  return t;
+}
+
+size_t
+trace_read(trace_t *t, uint32_t *pc, uint8_t *outcome, size_t max)
+{
+  if (t->error[0] != '\0') {
+    return 0;
+  }
+  if (t->format == FORMAT_BINARY) {
+    return bin_read(t, pc, outcome, max);
+  }
+  return text_read(t, pc, outcome, max);
+}
+
+const char *
+trace_error(trace_t *t)
+{
+  return (t->error[0] != '\0') ? t->error : NULL;
+}
+
+double
+trace_progress(trace_t *t)
+{
+  if (t->format == FORMAT_BINARY) {
+    // Blocks hold the same number of branches but the last
+    return t->hdr.num_blocks ? (double)t->next_block / t->hdr.num_blocks : 1;
+  }
+  if (t->bz != NULL) {
+    return (double)bz2_reader_position(t->bz) / t->image_len;
+  }
+  return t->size ? (double)t->consumed / t->size : -1;
+}
+
+void
+trace_close(trace_t *t)
+{
+  if (t->bz != NULL) {
+    bz2_reader_close(t->bz);
+  }
+  if (t->bzs != NULL) {
+    BZ2_bzDecompressEnd(t->bzs);
+    free(t->bzs);
+  }
+  free(t->bz_in);
+  if (t->mapped) {
+    munmap((void *)t->image, t->map_len);
+  }
+  if (t->fd > 0) {
+    close(t->fd);
+  }
+  free(t->buf);
+  free(t);
+}
+
+int
+trace_load(const char *path, trace_buf_t *tb, char *err, size_t errlen)
+{
+  trace_t *t = trace_open(path);
+  if (t == NULL) {
+    snprintf(err, errlen, "%s", strerror(errno));
+    return 0;
+  }
+
+  size_t cap = 1 << 20;
+  tb->pc = malloc(cap * sizeof(uint32_t));
+  tb->outcome = malloc(cap);
+  tb->n = 0;
+  tb->id = NULL;
+  tb->pcs = NULL;
+  tb->npcs = 0;
+
+  size_t got;
+  do {
+    if (cap - tb->n < TRACE_BIN_BLOCK) {
+      cap *= 2;
+      tb->pc = realloc(tb->pc, cap * sizeof(uint32_t));
+      tb->outcome = realloc(tb->outcome, cap);
+    }
+    got = trace_read(t, tb->pc + tb->n, tb->outcome + tb->n, cap - tb->n);
+    tb->n += got;
+  } while (got > 0);
+
+  int ok = (trace_error(t) == NULL);
+  if (!ok) {
+    snprintf(err, errlen, "%s", trace_error(t));
+    trace_buf_free(tb);
+  }
+  trace_close(t);
+  return ok;
+}
+
+// Slot of the dictionary built by trace_buf_index
+typedef struct {
+  uint32_t pc;
+  uint32_t id;    // ID + 1, 0 marks an empty slot
+} trace_dict_slot_t;
+
+void
+trace_buf_index(trace_buf_t *tb)
+{
+  // One pass through an open-addressing table kept at most half full;
+  // each new PC takes the next ID
+  int bits = 12;
+  trace_dict_slot_t *slots = calloc((size_t)1 << bits, sizeof(*slots));
+  uint32_t mask = ((uint32_t)1 << bits) - 1;
+
+  free(tb->id);
+  free(tb->pcs);
+  tb->id = malloc(tb->n * sizeof(uint32_t));
+  tb->pcs = malloc(((size_t)mask + 1) / 2 * sizeof(uint32_t));
+  tb->npcs = 0;
+
+  for (size_t i = 0; i < tb->n; i++) {
+    uint32_t pc = tb->pc[i];
+    uint32_t h = (pc * 0x9E3779B1u) >> (32 - bits);
+
+    while (slots[h].id != 0 && slots[h].pc != pc) {
+      h = (h + 1) & mask;
+    }
+    if (slots[h].id == 0) {
+      if (2 * (tb->npcs + 1) > mask) {
+        // Double the table and rehash the PCs seen so far, in ID order
+        free(slots);
+        bits++;
+        slots = calloc((size_t)1 << bits, sizeof(*slots));
+        mask = ((uint32_t)1 << bits) - 1;
+        tb->pcs = realloc(tb->pcs, ((size_t)mask + 1) / 2 * sizeof(uint32_t));
+        for (uint32_t j = 0; j < tb->npcs; j++) {
+          uint32_t g = (tb->pcs[j] * 0x9E3779B1u) >> (32 - bits);
+          while (slots[g].id != 0) {
+            g = (g + 1) & mask;
+          }
+          slots[g].pc = tb->pcs[j];
+          slots[g].id = j + 1;
+        }
+        h = (pc * 0x9E3779B1u) >> (32 - bits);
+        while (slots[h].id != 0) {
+          h = (h + 1) & mask;
+        }
+      }
+      slots[h].pc = pc;
+      slots[h].id = ++tb->npcs;
+      tb->pcs[tb->npcs - 1] = pc;
+    }
+    tb->id[i] = slots[h].id - 1;
+  }
+  free(slots);
+}
+
+void
+trace_buf_free(trace_buf_t *tb)
+{
+  free(tb->pc);
+  free(tb->outcome);
+  free(tb->id);
+  free(tb->pcs);
+  tb->pc = NULL;
+  tb->outcome = NULL;
+  tb->id = NULL;
+  tb->pcs = NULL;
+  tb->n = 0;
+  tb->npcs = 0;
+}
+
+//------------------------------------//
+//       Trace Writer Functions       //
+//------------------------------------//
+
+struct trace_writer {
+  FILE *fp;
+  trace_bin_header_t hdr;
+  uint32_t *pc;         // Branches of the block being filled
+  uint8_t *outcome;
+  uint32_t count;
+  uint8_t *enc;         // Encoding buffer for one block
+  uint64_t *index;
+  uint32_t index_cap;
+  uint64_t offset;      // Current file offset
+};
+
+// Encode and write the pending block
+//
+// Returns True if Successful
+//
+static int
+writer_flush(trace_writer_t *w)
+{
+  if (w->count == 0) {
+    return 1;
+  }
+
+  uint32_t nbits = (w->count + 7) / 8;
+  uint8_t *bits = w->enc;
+  uint8_t *p = w->enc + nbits;
+  uint32_t prev = 0;
+
+  memset(bits, 0, nbits);
+  for (uint32_t i = 0; i < w->count; i++) {
+    bits[i >> 3] |= (w->outcome[i] & 1) << (i & 7);
+    p = varint_put(p, zigzag_encode((int32_t)(w->pc[i] - prev)));
+    prev = w->pc[i];
+  }
+
+  uint32_t head[2] = { w->count, (uint32_t)(p - bits) - nbits };
+  if (w->hdr.num_blocks == w->index_cap) {
+    w->index_cap = w->index_cap ? 2 * w->index_cap : 256;
+    w->index = realloc(w->index, w->index_cap * sizeof(uint64_t));
+  }
+  w->index[w->hdr.num_blocks++] = w->offset;
+
+  if (fwrite(head, sizeof(head), 1, w->fp) != 1 ||
+      fwrite(w->enc, p - w->enc, 1, w->fp) != 1) {
+    return 0;
+  }
+  w->offset += sizeof(head) + (p - w->enc);
+  w->hdr.num_branches += w->count;
+  w->count = 0;
+  return 1;
+}
+
+trace_writer_t *
+trace_writer_open(const char *path, uint32_t block_size)
+{
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    return NULL;
+  }
+
+  trace_writer_t *w = calloc(1, sizeof(trace_writer_t));
+  w->fp = fp;
+  memcpy(w->hdr.magic, TRACE_BIN_MAGIC, 4);
+  w->hdr.version = TRACE_BIN_VERSION;
+  w->hdr.block_size = block_size;
+  w->pc = malloc(block_size * sizeof(uint32_t));
+  w->outcome = malloc(block_size);
+  w->enc = malloc((block_size + 7) / 8 + 5 * (size_t)block_size);
+
+  // The header is rewritten once the index is known
+  fwrite(&w->hdr, sizeof(w->hdr), 1, fp);
+  w->offset = sizeof(w->hdr);
+  return w;
+}
+
+int
+trace_writer_put(trace_writer_t *w, const uint32_t *pc,
+                 const uint8_t *outcome, size_t n)
+{
+  while (n > 0) {
+    size_t take = w->hdr.block_size - w->count;
+    if (take > n) {
+      take = n;
+    }
+    memcpy(w->pc + w->count, pc, take * sizeof(uint32_t));
+    memcpy(w->outcome + w->count, outcome, take);
+    w->count += take;
+    pc += take;
+    outcome += take;
+    n -= take;
+    if (w->count == w->hdr.block_size && !writer_flush(w)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int
+trace_writer_close(trace_writer_t *w)
+{
+  int ok = writer_flush(w);
+
+  // Keep the index 8-byte aligned so readers can use it in place
+  static const uint8_t pad[8];
+  uint32_t npad = (8 - (w->offset & 7)) & 7;
+  ok = ok && fwrite(pad, 1, npad, w->fp) == npad;
+  w->hdr.index_offset = w->offset + npad;
+  ok = ok && fwrite(w->index, sizeof(uint64_t), w->hdr.num_blocks, w->fp)
+               == w->hdr.num_blocks;
+  ok = ok && fseek(w->fp, 0, SEEK_SET) == 0;
+  ok = ok && fwrite(&w->hdr, sizeof(w->hdr), 1, w->fp) == 1;
+  ok = (fclose(w->fp) == 0) && ok;
+
+  free(w->pc);
+  free(w->outcome);
+  free(w->enc);
+  free(w->index);
+  free(w);
+  return ok;
+}
@@ -0,0 +1,140 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for the Branch Trace readers and writers  //
+//                                                        //
+//  Includes the binary trace format and the functions   //
+//  used to stream branches out of a trace file           //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+//------------------------------------//
+//        Binary Trace Format         //
+//------------------------------------//
+
+// A binary trace is laid out as (all integers little-endian):
+//
+//   trace_bin_header_t
+//   num_blocks x { uint32_t count, uint32_t nbytes,
+//                  outcome bits[(count + 7) / 8],
+//                  pc varints[nbytes] }
+//   num_blocks x uint64_t file offset of each block
+//
+// Outcomes are packed LSB first.  Each PC is stored as the zigzag
+// LEB128 varint of its difference to the previous PC of the same
+// block.  Every block restarts from pc 0, so any block can be decoded
+// on its own through the index.
+//
+#define TRACE_BIN_MAGIC    "BPTR"
+#define TRACE_BIN_VERSION  1
+#define TRACE_BIN_BLOCK    4096   // Default branches per block
+
+typedef struct {
+  char     magic[4];      // TRACE_BIN_MAGIC
+  uint32_t version;       // TRACE_BIN_VERSION
+  uint64_t num_branches;  // Total branches in the trace
+  uint32_t block_size;    // Branches per block (the last may be short)
+  uint32_t num_blocks;    // Number of blocks / index entries
+  uint64_t index_offset;  // File offset of the block index
+} trace_bin_header_t;
+
+//------------------------------------//
+//    Trace Reader Configuration    //
+//------------------------------------//
+extern int traceThreads;  // Threads decompressing .bz2 traces (0 = all cores)
+
+//------------------------------------//
+//       Trace Reader Prototypes      //
+//------------------------------------//
+
+typedef struct trace trace_t;
+
+// Open a trace for reading; a NULL path reads from stdin.  The format
+// (text, bzip2 compressed text or binary) is detected from the first
+// bytes of the input.  Memory use does not grow with the length of the
+// trace.  Compressed input read from a pipe is decompressed on the
+// reading thread; binary input must be a file, and a pipe fails on the
+// first read.
+//
+// Returns NULL and sets errno on failure
+//
+trace_t *trace_open(const char *path);
+
+// Decode up to 'max' branches into 'pc' and 'outcome'
+//
+// Returns the number of branches decoded, 0 at the end of the trace
+// or on error (see trace_error)
+//
+size_t trace_read(trace_t *t, uint32_t *pc, uint8_t *outcome, size_t max);
+
+// Returns a description of the last decoding error, or NULL
+//
+const char *trace_error(trace_t *t);
+
+// Returns the fraction of the input decoded so far, or a negative
+// value when its size is not known (text read from a pipe)
+//
+double trace_progress(trace_t *t);
+
+// Close the trace and release its buffers
+//
+void trace_close(trace_t *t);
+
+// A whole trace decoded into memory, shared read-only by the
+// simulations that replay it
+typedef struct {
+  uint32_t *pc;
+  uint8_t *outcome;
+  size_t n;
+  uint32_t *id;     // Dense ID of each branch's PC, once indexed
+  uint32_t *pcs;    // PC of each ID, in order of first execution
+  uint32_t npcs;    // Static branches
+} trace_buf_t;
+
+// Decode the whole trace at 'path' (NULL for stdin) into 'tb'
+//
+// Returns True if Successful, otherwise describes the problem in 'err'
+//
+int trace_load(const char *path, trace_buf_t *tb, char *err, size_t errlen);
+
+// Number the static branches of 'tb' densely from 0 in order of first
+// execution and store the number of each branch in 'tb->id', so that
+// per-branch state can live in flat arrays of 'tb->npcs' entries
+// instead of tables hashed by PC
+//
+void trace_buf_index(trace_buf_t *tb);
+
+// Release the arrays of 'tb'
+//
+void trace_buf_free(trace_buf_t *tb);
+
+//------------------------------------//
+//       Trace Writer Prototypes      //
+//------------------------------------//
+
+typedef struct trace_writer trace_writer_t;
+
+// Create a binary trace at 'path' with 'block_size' branches per block
+//
+// Returns NULL and sets errno on failure
+//
+trace_writer_t *trace_writer_open(const char *path, uint32_t block_size);
+
+// Append 'n' branches to the trace
+//
+// Returns True if Successful
+//
+int trace_writer_put(trace_writer_t *w, const uint32_t *pc,
+                     const uint8_t *outcome, size_t n);
+
+// Flush the last block, write the index and header and close the file
+//
+// Returns True if Successful
+//
+int trace_writer_close(trace_writer_t *w);
+
+#endif
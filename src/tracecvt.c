@@ -0,0 +1,120 @@
+//========================================================//
+//  tracecvt.c                                            //
+//  Converts branch traces between the text format and    //
+//  the compact binary format read by the predictor       //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+#define BLOCK_SIZE 65536  // Branches moved per trace_read() call
+
+uint32_t pc_block[BLOCK_SIZE];
+uint8_t outcome_block[BLOCK_SIZE];
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: tracecvt <options> <input> <output>\n");
+  fprintf(stderr,"       bunzip2 -kc trace.bz2 | tracecvt <options> - <output>\n");
+  fprintf(stderr," Options:\n");
+  fprintf(stderr," --help         Print this message\n");
+  fprintf(stderr," --block:<n>    Branches per binary block (default %d)\n",
+          TRACE_BIN_BLOCK);
+  fprintf(stderr," --text         Write a text trace instead of a binary one\n"
+                 "                ('-' as output writes to stdout)\n");
+}
+
+// Write 'n' branches as "0x<pc> <outcome>" lines
+//
+// Returns True if Successful
+//
+int
+write_text(FILE *fp, const uint32_t *pc, const uint8_t *outcome, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    if (fprintf(fp, "0x%x %d\n", pc[i], outcome[i]) < 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint32_t block_size = TRACE_BIN_BLOCK;
+  int text = 0;
+  char *paths[2];
+  int npaths = 0;
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i],"--help")) {
+      usage();
+      exit(0);
+    } else if (!strncmp(argv[i],"--block:",8)) {
+      block_size = strtoul(argv[i]+8, NULL, 10);
+    } else if (!strcmp(argv[i],"--text")) {
+      text = 1;
+    } else if (strncmp(argv[i],"--",2) && npaths < 2) {
+      paths[npaths++] = argv[i];
+    } else {
+      printf("Unrecognized option %s\n", argv[i]);
+      usage();
+      exit(1);
+    }
+  }
+  if (npaths != 2 || block_size == 0) {
+    usage();
+    exit(1);
+  }
+
+  const char *in_path = strcmp(paths[0], "-") ? paths[0] : NULL;
+  trace_t *in = trace_open(in_path);
+  if (in == NULL) {
+    fprintf(stderr, "Unable to open %s\n", paths[0]);
+    exit(1);
+  }
+
+  FILE *text_out = NULL;
+  trace_writer_t *bin_out = NULL;
+  if (text) {
+    text_out = strcmp(paths[1], "-") ? fopen(paths[1], "w") : stdout;
+  } else {
+    bin_out = trace_writer_open(paths[1], block_size);
+  }
+  if (text_out == NULL && bin_out == NULL) {
+    fprintf(stderr, "Unable to create %s\n", paths[1]);
+    exit(1);
+  }
+
+  // Copy every branch from the input to the output
+  int ok = 1;
+  size_t n;
+  while (ok && (n = trace_read(in, pc_block, outcome_block, BLOCK_SIZE)) > 0) {
+    ok = text ? write_text(text_out, pc_block, outcome_block, n)
+              : trace_writer_put(bin_out, pc_block, outcome_block, n);
+  }
+  if (trace_error(in) != NULL) {
+    fprintf(stderr, "%s: %s\n", paths[0], trace_error(in));
+    exit(1);
+  }
+  if (text) {
+    ok = (fclose(text_out) == 0) && ok;
+  } else {
+    ok = trace_writer_close(bin_out) && ok;
+  }
+  if (!ok) {
+    fprintf(stderr, "Error writing %s\n", paths[1]);
+    exit(1);
+  }
+
+  trace_close(in);
+  return 0;
+}
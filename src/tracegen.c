@@ -0,0 +1,343 @@
+//========================================================//
+//  tracegen.c                                            //
+//  Generates synthetic branch traces of any length for   //
+//  scaling tests, in the text format or the binary one   //
+//                                                        //
+//  The trace runs a made-up program: a set of loop nests //
+//  whose bodies hold biased, random and correlated       //
+//  branches.  Everything is drawn from one seeded PRNG,  //
+//  so a seed always gives the same trace                 //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+#define BLOCK_SIZE 65536  // Branches generated per block
+#define MAX_LEVELS 8      // Deepest loop nest
+
+// Kinds of body branches
+#define KIND_CORRELATED 0  // Repeats or inverts a recent global outcome
+#define KIND_BIASED     1  // Taken with a fixed probability
+#define KIND_RANDOM     2  // Taken half of the time
+#define KINDS           3
+
+typedef struct {
+  uint32_t pc;
+  uint8_t kind;
+  uint8_t distance;       // Outcome a correlated branch follows, 0 the last
+  uint8_t invert;         // Complement it
+  uint64_t threshold;     // A biased or random branch is taken below this
+  char text[12];          // "0x<pc> " for the text format
+  int len;
+} branch_t;
+
+// The program: 'nests' loop nests, each 'body' branches followed by
+// one loop branch per level, innermost first
+typedef struct {
+  branch_t *branches;     // nests x (body + levels)
+  uint32_t nests;
+  uint32_t body;
+  int levels;
+  uint32_t trip[MAX_LEVELS];  // Trip count of each level, innermost first
+
+  // Position in the program
+  uint64_t rng;
+  uint64_t history;       // Global outcomes, newest in bit 0
+  uint32_t nest;          // Nest being run
+  uint32_t pos;           // Next body branch, or 'body' in the loop tail
+  int level;              // Level of the next loop branch, 0 innermost
+  uint32_t iter[MAX_LEVELS];
+} gen_t;
+
+uint32_t id_block[BLOCK_SIZE];
+uint32_t pc_block[BLOCK_SIZE];
+uint8_t outcome_block[BLOCK_SIZE];
+char text_block[BLOCK_SIZE * 13];
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: tracegen <options> [<output>]\n");
+  fprintf(stderr," Options:\n");
+  fprintf(stderr," --help         Print this message\n");
+  fprintf(stderr," --branches:<n> Branches to generate (default 10000000)\n");
+  fprintf(stderr," --seed:<n>     Seed of the generator (default 1)\n");
+  fprintf(stderr," --pcs:<n>      Static branches, about (default 1024)\n");
+  fprintf(stderr," --body:<n>     Branches in the body of each loop nest\n"
+                 "                (default 6)\n");
+  fprintf(stderr," --loops:<t>[:<t>...]  Trip counts of the nested loops,\n"
+                 "                outermost first (default 4:8)\n");
+  fprintf(stderr," --mix:<c>:<b>:<r>  Weights of correlated, biased and\n"
+                 "                random branches in the bodies (default 30:60:10)\n");
+  fprintf(stderr," --bias:<pct>   Probability of the likely outcome of a\n"
+                 "                biased branch (default 90)\n");
+  fprintf(stderr," --depth:<n>    Furthest outcome a correlated branch\n"
+                 "                follows (default 8)\n");
+  fprintf(stderr," --binary       Write a binary trace instead of a text one\n");
+  fprintf(stderr," --block:<n>    Branches per binary block (default %d)\n",
+          TRACE_BIN_BLOCK);
+  fprintf(stderr," The text trace goes to stdout unless <output> is given\n");
+}
+
+// xorshift64*, seeded through splitmix64 so that nearby seeds give
+// unrelated streams
+//
+static inline uint64_t
+rng_next(uint64_t *s)
+{
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545F4914F6CDD1Dull;
+}
+
+static uint64_t
+rng_seed(uint64_t seed)
+{
+  uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  z ^= z >> 31;
+  return z ? z : 1;
+}
+
+// Returns a number in [0, n)
+//
+static inline uint32_t
+rng_below(uint64_t *s, uint32_t n)
+{
+  return (uint32_t)(((rng_next(s) >> 32) * n) >> 32);
+}
+
+// Lay out the program: PCs rise through the code with a gap of one to
+// sixteen instructions between branches, and each body branch draws its
+// kind from 'mix'
+//
+static void
+gen_init(gen_t *g, uint64_t seed, uint32_t pcs, uint32_t body, int levels,
+         const uint32_t *trip, const uint32_t *mix, uint32_t bias, int depth)
+{
+  uint32_t per_nest = body + levels;
+  uint32_t total_mix = mix[0] + mix[1] + mix[2];
+  uint32_t pc = 0x400000;
+
+  memset(g, 0, sizeof(*g));
+  g->rng = rng_seed(seed);
+  g->nests = pcs / per_nest ? pcs / per_nest : 1;
+  g->body = body;
+  g->levels = levels;
+  for (int l = 0; l < levels; l++) {
+    g->trip[l] = trip[levels - 1 - l];
+  }
+  g->branches = calloc((size_t)g->nests * per_nest, sizeof(branch_t));
+
+  for (uint32_t i = 0; i < g->nests * per_nest; i++) {
+    branch_t *b = &g->branches[i];
+    pc += 4 * (1 + rng_below(&g->rng, 16));
+    b->pc = pc;
+    b->len = sprintf(b->text, "0x%x ", pc);
+    if (i % per_nest >= body) {
+      continue;   // Loop branch
+    }
+
+    uint32_t r = rng_below(&g->rng, total_mix);
+    b->kind = r < mix[0] ? KIND_CORRELATED :
+              r < mix[0] + mix[1] ? KIND_BIASED : KIND_RANDOM;
+    b->distance = rng_below(&g->rng, depth);
+    b->invert = rng_below(&g->rng, 2);
+    if (b->kind == KIND_BIASED) {
+      // Mostly taken or mostly not taken, at random
+      uint64_t p = b->invert ? 100 - bias : bias;
+      b->threshold = (p << 32) / 100;
+    } else {
+      b->threshold = (uint64_t)1 << 31;
+    }
+  }
+  g->nest = rng_below(&g->rng, g->nests);
+}
+
+// Generate the next 'max' branches as indices into g->branches
+//
+static void
+gen_fill(gen_t *g, uint32_t *id, uint8_t *outcome, size_t max)
+{
+  uint32_t per_nest = g->body + g->levels;
+  uint64_t history = g->history;
+  size_t n = 0;
+
+  while (n < max) {
+    uint32_t base = g->nest * per_nest;
+    uint8_t taken;
+
+    if (g->pos < g->body) {
+      const branch_t *b = &g->branches[base + g->pos];
+      id[n] = base + g->pos++;
+      if (b->kind == KIND_CORRELATED) {
+        taken = ((history >> b->distance) ^ b->invert) & 1;
+      } else {
+        taken = (rng_next(&g->rng) >> 32) < b->threshold;
+      }
+    } else if (g->level < g->levels) {
+      // The loop branch of 'level' goes back for another iteration
+      // until the trip count is reached, then falls through to the
+      // loop branch around it
+      int l = g->level;
+      id[n] = base + g->body + l;
+      taken = ++g->iter[l] < g->trip[l];
+      if (taken) {
+        g->pos = 0;
+        g->level = 0;
+      } else {
+        g->iter[l] = 0;
+        g->level++;
+      }
+    } else {
+      // The nest is done; the program moves to another one
+      g->nest = rng_below(&g->rng, g->nests);
+      g->pos = 0;
+      g->level = 0;
+      continue;
+    }
+    outcome[n++] = taken;
+    history = (history << 1) | taken;
+  }
+  g->history = history;
+}
+
+// Write 'n' branches as "0x<pc> <outcome>" lines, formatted into one
+// buffer from the preformatted PCs
+//
+// Returns True if Successful
+//
+static int
+write_text(FILE *fp, const gen_t *g, const uint32_t *id,
+           const uint8_t *outcome, size_t n)
+{
+  char *out = text_block;
+  for (size_t i = 0; i < n; i++) {
+    const branch_t *b = &g->branches[id[i]];
+    memcpy(out, b->text, 12);
+    out += b->len;
+    out[0] = '0' + outcome[i];
+    out[1] = '\n';
+    out += 2;
+  }
+  return fwrite(text_block, 1, out - text_block, fp) == (size_t)(out - text_block);
+}
+
+int
+main(int argc, char *argv[])
+{
+  unsigned long long branches = 10000000;
+  unsigned long long seed = 1;
+  uint32_t pcs = 1024;
+  uint32_t body = 6;
+  uint32_t trip[MAX_LEVELS] = { 4, 8 };
+  int levels = 2;
+  uint32_t mix[KINDS] = { 30, 60, 10 };
+  uint32_t bias = 90;
+  int depth = 8;
+  int binary = 0;
+  uint32_t block_size = TRACE_BIN_BLOCK;
+  char *path = NULL;
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i) {
+    int ok = 1;
+    if (!strcmp(argv[i],"--help")) {
+      usage();
+      exit(0);
+    } else if (!strncmp(argv[i],"--branches:",11)) {
+      ok = sscanf(argv[i]+11,"%llu", &branches) == 1;
+    } else if (!strncmp(argv[i],"--seed:",7)) {
+      ok = sscanf(argv[i]+7,"%llu", &seed) == 1;
+    } else if (!strncmp(argv[i],"--pcs:",6)) {
+      ok = sscanf(argv[i]+6,"%u", &pcs) == 1;
+    } else if (!strncmp(argv[i],"--body:",7)) {
+      ok = sscanf(argv[i]+7,"%u", &body) == 1;
+    } else if (!strncmp(argv[i],"--loops:",8)) {
+      char *s = argv[i]+8;
+      for (levels = 0; ok && *s != '\0'; levels++) {
+        char *end;
+        ok = levels < MAX_LEVELS;
+        if (ok) {
+          trip[levels] = strtoul(s, &end, 10);
+          ok = end != s && trip[levels] > 0 && (*end == ':' || *end == '\0');
+          s = *end ? end + 1 : end;
+        }
+      }
+    } else if (!strncmp(argv[i],"--mix:",6)) {
+      ok = sscanf(argv[i]+6,"%u:%u:%u", &mix[0], &mix[1], &mix[2]) == 3 &&
+           mix[0] + mix[1] + mix[2] > 0;
+    } else if (!strncmp(argv[i],"--bias:",7)) {
+      ok = sscanf(argv[i]+7,"%u", &bias) == 1 && bias <= 100;
+    } else if (!strncmp(argv[i],"--depth:",8)) {
+      ok = sscanf(argv[i]+8,"%d", &depth) == 1 && depth >= 1 && depth <= 64;
+    } else if (!strcmp(argv[i],"--binary")) {
+      binary = 1;
+    } else if (!strncmp(argv[i],"--block:",8)) {
+      block_size = strtoul(argv[i]+8, NULL, 10);
+    } else if (strncmp(argv[i],"--",2) && path == NULL) {
+      path = argv[i];
+    } else {
+      ok = 0;
+    }
+    if (!ok) {
+      printf("Unrecognized option %s\n", argv[i]);
+      usage();
+      exit(1);
+    }
+  }
+  if (body == 0 || block_size == 0 || (binary && path == NULL)) {
+    usage();
+    exit(1);
+  }
+
+  FILE *text_out = NULL;
+  trace_writer_t *bin_out = NULL;
+  if (binary) {
+    bin_out = trace_writer_open(path, block_size);
+  } else {
+    text_out = (path && strcmp(path, "-")) ? fopen(path, "w") : stdout;
+  }
+  if (text_out == NULL && bin_out == NULL) {
+    fprintf(stderr, "Unable to create %s\n", path);
+    exit(1);
+  }
+
+  gen_t g;
+  gen_init(&g, seed, pcs, body, levels, trip, mix, bias, depth);
+
+  // Generate and write the trace a block at a time
+  int ok = 1;
+  while (ok && branches > 0) {
+    size_t n = branches < BLOCK_SIZE ? branches : BLOCK_SIZE;
+    gen_fill(&g, id_block, outcome_block, n);
+    if (binary) {
+      for (size_t i = 0; i < n; i++) {
+        pc_block[i] = g.branches[id_block[i]].pc;
+      }
+      ok = trace_writer_put(bin_out, pc_block, outcome_block, n);
+    } else {
+      ok = write_text(text_out, &g, id_block, outcome_block, n);
+    }
+    branches -= n;
+  }
+  if (binary) {
+    ok = trace_writer_close(bin_out) && ok;
+  } else {
+    ok = (fclose(text_out) == 0) && ok;
+  }
+  if (!ok) {
+    fprintf(stderr, "Error writing %s\n", path ? path : "stdout");
+    exit(1);
+  }
+
+  free(g.branches);
+  return 0;
+}